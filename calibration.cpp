@@ -72,8 +72,10 @@ void Calibration::init_check(void) {
     // Initialize EEPROM and read offsets and matrices
     EEPROM.begin();
     delay(10);
-    gain_1_offset = dip_to_gain_offset(EEPROM.read(EEPROM_ADDR_GAIN_1));
-    gain_2_offset = dip_to_gain_offset(EEPROM.read(EEPROM_ADDR_GAIN_2));
+    gain_1_raw = EEPROM.read(EEPROM_ADDR_GAIN_1);
+    gain_2_raw = EEPROM.read(EEPROM_ADDR_GAIN_2);
+    gain_1_offset = dip_to_gain_offset(gain_1_raw);
+    gain_2_offset = dip_to_gain_offset(gain_2_raw);
 
     DEBUG(F("Gain offsets: "));
     DEBUG(gain_1_offset);
@@ -111,41 +113,50 @@ void Calibration::init_check(void) {
  * NOTE: Call `read_matrices()` first
  *
  * @param channel 0 to use calib_matrix_1, 1 to use calib_matrix_2
- * @param cents MIDI note number in cents (12 is minimum allowed value). Ex.: 6000 - C4
- * @return float
+ * @param pitch MIDI note number in Q8.8 (see PITCH_SEMITONE). Clamped to 12 (C0) - 127 (G9) range
+ * @return uint16_t voltage in Q14.2 mV (see MV_Q2_ONE)
  */
-float Calibration::note_to_mv_cal(uint8_t channel, uint16_t cents) {
+uint16_t Calibration::note_to_mv_cal(uint8_t channel, uint16_t pitch) {
     // Check input range
-    if (cents < 1200U || cents > 12700U)
-        return 0.f;
+    if (pitch < 12U * PITCH_SEMITONE)
+        pitch = 12U * PITCH_SEMITONE;
+    else if (pitch > PITCH_MAX)
+        pitch = PITCH_MAX;
 
     struct calibMatrix *matrix = channel ? &calib_matrix_2 : &calib_matrix_1;
 
-    // No calibration stored or currently in calibration
+    // No calibration stored, currently in calibration or matrices are being restored
     if (matrix->note_min > 127U || matrix->note_max > 127U || matrix->note_min == 0U ||
         matrix->note_min >= matrix->note_max || stage == CalibStage::PREP_VCO_1 || stage == CalibStage::PREP_VCO_2 ||
-        stage == CalibStage::VCO_1 || stage == CalibStage::VCO_2)
-        return note_to_mv(cents);
+        stage == CalibStage::VCO_1 || stage == CalibStage::VCO_2 || backup_active)
+        return pitch_to_mv_q2(pitch);
 
-    float note = static_cast<float>(cents) / 100.f;
+    uint8_t note = static_cast<uint8_t>(pitch / PITCH_SEMITONE);
 
     uint8_t note_min, note_max;
 
-    if (static_cast<uint8_t>(note) >= matrix->note_max) {
+    if (note >= matrix->note_max) {
         note_min = matrix->note_max - 1U;
         note_max = matrix->note_max;
-    } else if (static_cast<uint8_t>(note) <= matrix->note_min) {
+    } else if (note <= matrix->note_min) {
         note_min = matrix->note_min;
         note_max = matrix->note_min + 1U;
     } else {
         note_min = note;
-        note_max = static_cast<uint8_t>(note) + 1;
+        note_max = note + 1U;
     }
 
-    // Interpolate matrix
-    return map_f(note, static_cast<float>(note_min), static_cast<float>(note_max),
-                 static_cast<float>(matrix->matrix[note_min - 12U]),
-                 static_cast<float>(matrix->matrix[note_max - 12U]));
+    // Interpolate (or extrapolate outside calibrated range) matrix. Distance from note_min is in Q8.8 semitones,
+    // so (mV difference * distance) / 256 * 4 is Q14.2
+    int32_t mv_min = static_cast<int32_t>(matrix->matrix[note_min - 12U]);
+    int32_t mv_max = static_cast<int32_t>(matrix->matrix[note_max - 12U]);
+    int32_t distance = static_cast<int32_t>(pitch) - static_cast<int32_t>(note_min) * PITCH_SEMITONE;
+    int32_t mv_q2 = mv_min * MV_Q2_ONE + (((mv_max - mv_min) * distance) >> 6);
+    if (mv_q2 < 0L)
+        return 0U;
+    if (mv_q2 > static_cast<int32_t>(DAC_KEEP - 1U))
+        return DAC_KEEP - 1U;
+    return static_cast<uint16_t>(mv_q2);
 }
 
 /**
@@ -214,7 +225,8 @@ void Calibration::tuner(void) {
         target_note = 11U;
     uint16_t target_cents =
         (static_cast<uint16_t>(target_octave) * 12U + static_cast<uint16_t>(target_note) + 12U) * 100U;
-    dac.set(note_to_mv_cal(0U, target_cents), note_to_mv_cal(1U, target_cents));
+    uint16_t target_pitch = static_cast<uint16_t>(target_cents / 100U) * PITCH_SEMITONE;
+    dac.set_mv_q2(note_to_mv_cal(0U, target_pitch), note_to_mv_cal(1U, target_pitch));
     target_frequency = note_to_hz(target_cents);
     tuner_deviation_cents = hz_to_cents_deviation(target_frequency, frequency);
 }
@@ -495,12 +507,14 @@ void Calibration::btn_long_press(void) {
 
     // Confirm and write DAC gain calibration and go to the next stage
     case CalibStage::GAIN_1:
-        EEPROM.write(EEPROM_ADDR_GAIN_1, dip_switch.states);
+        gain_1_raw = dip_switch.states;
+        EEPROM.write(EEPROM_ADDR_GAIN_1, gain_1_raw);
         dac.set(0.f, 0.f);
         stage = CalibStage::PREP_GAIN_2;
         break;
     case CalibStage::GAIN_2:
-        EEPROM.write(EEPROM_ADDR_GAIN_2, dip_switch.states);
+        gain_2_raw = dip_switch.states;
+        EEPROM.write(EEPROM_ADDR_GAIN_2, gain_2_raw);
         dac.set(0.f, 0.f);
         stage = CalibStage::PREP_TUNER;
         break;
@@ -590,6 +604,74 @@ void Calibration::write_matrices(void) {
     EEPROM.put<calibMatrix>(EEPROM_ADDR_MATRIX_2, calib_matrix_2);
 }
 
+/**
+ * @brief Maps backup image index into calibration data.
+ * Image layout: [0] - raw 1st DAC gain, [1] - raw 2nd DAC gain, then calib_matrix_1 and calib_matrix_2 as stored
+ * in memory (and EEPROM)
+ *
+ * @param index 0 to CALIB_BACKUP_SIZE - 1
+ * @return uint8_t* pointer to the byte or nullptr if index is out of range
+ */
+uint8_t *Calibration::backup_byte(uint16_t index) {
+    if (index == 0U)
+        return &gain_1_raw;
+    if (index == 1U)
+        return &gain_2_raw;
+    index -= 2U;
+    if (index < sizeof(calibMatrix))
+        return reinterpret_cast<uint8_t *>(&calib_matrix_1) + index;
+    index -= sizeof(calibMatrix);
+    if (index < sizeof(calibMatrix))
+        return reinterpret_cast<uint8_t *>(&calib_matrix_2) + index;
+    return nullptr;
+}
+
+/**
+ * @brief Reads one byte of calibration backup image (see `backup_byte()` for layout)
+ *
+ * @param index 0 to CALIB_BACKUP_SIZE - 1
+ * @return uint8_t byte value or 0 if index is out of range
+ */
+uint8_t Calibration::backup_read(uint16_t index) {
+    uint8_t *byte = backup_byte(index);
+    return byte ? *byte : 0U;
+}
+
+/**
+ * @brief Writes one byte of calibration backup image directly into calibration data.
+ * Calibration matrices are not used until `backup_commit()` is called
+ *
+ * @param index 0 to CALIB_BACKUP_SIZE - 1
+ * @param value byte value
+ */
+void Calibration::backup_write(uint16_t index, uint8_t value) {
+    uint8_t *byte = backup_byte(index);
+    if (!byte)
+        return;
+    backup_active = true;
+    *byte = value;
+}
+
+/**
+ * @brief Finishes backup restoring. Saves restored data into EEPROM if it's valid or reverts it from EEPROM otherwise
+ *
+ * @param valid true if whole image was received and checksum matches
+ */
+void Calibration::backup_commit(boolean valid) {
+    if (valid) {
+        EEPROM.update(EEPROM_ADDR_GAIN_1, gain_1_raw);
+        EEPROM.update(EEPROM_ADDR_GAIN_2, gain_2_raw);
+        write_matrices();
+    } else {
+        gain_1_raw = EEPROM.read(EEPROM_ADDR_GAIN_1);
+        gain_2_raw = EEPROM.read(EEPROM_ADDR_GAIN_2);
+        read_matrices();
+    }
+    gain_1_offset = dip_to_gain_offset(gain_1_raw);
+    gain_2_offset = dip_to_gain_offset(gain_2_raw);
+    backup_active = false;
+}
+
 /**
  * @brief Measures raw VCO's frequency using time between interrupts
  */
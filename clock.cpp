@@ -26,10 +26,22 @@
  */
 
 #include "include/clock.h"
+#include "include/perf.h"
 #include "include/pins.h"
+#include "include/timebase.h"
+#include "include/uart.h"
 
 #include <util/atomic.h>
 
+#ifdef MIDI_MERGE
+#if 24U % MIDI_MERGE_EXT_PPQN != 0U
+#error "MIDI_MERGE_EXT_PPQN must divide 24"
+#endif
+
+// MIDI timing clocks per external clock edge
+#define MIDI_MERGE_CLOCKS_PER_EDGE (24U / MIDI_MERGE_EXT_PPQN)
+#endif
+
 // Preinstantiate
 Clock clock;
 
@@ -40,12 +52,27 @@ void Clock::init(void) {
     port_out_reg = portOutputRegister(digitalPinToPort(PIN_CLOCK));
     pin_mask = digitalPinToBitMask(PIN_CLOCK);
     source = ClockSource::NONE;
+    running = true;
+#ifdef CLOCK_JITTER_PROBE
+    probe_latency_min = UINT16_MAX;
+    probe_latency_max = 0U;
+#endif
+#ifdef CLOCK_PLL
+    pll_bandwidth = CLOCK_PLL_BANDWIDTH;
+    pll_restart();
+#endif
 }
 
+/**
+ * @brief Switches clock port direction and source. Safe to call from interrupts
+ *
+ * @param source NONE, MIDI (port output) or EXT (port input)
+ */
 void Clock::set_source(enum ClockSource source) {
     if (source == this->source)
         return;
 
+    uint8_t sreg = SREG;
     noInterrupts();
     detachInterrupt(digitalPinToInterrupt(PIN_CLOCK));
 
@@ -53,14 +80,21 @@ void Clock::set_source(enum ClockSource source) {
     if (source == ClockSource::MIDI) {
         pinMode(PIN_CLOCK, OUTPUT);
         write_output(false);
+        clock_event_midi = false;
     }
 
     // Port input -> clock
     else if (source == ClockSource::EXT) {
         pinMode(PIN_CLOCK, INPUT);
         attachInterrupt(digitalPinToInterrupt(PIN_CLOCK), isr, RISING);
-        ticks_counter = 0U;
         clock_event = false;
+
+        // MIDI clock timed out -> returning MIDI clock runs from the downbeat even without Start (unless transport
+        // messages are received before it)
+        if (this->source == ClockSource::MIDI) {
+            running = true;
+            seek(0U);
+        }
     }
 
     // Turn OFF clock completely
@@ -73,36 +107,149 @@ void Clock::set_source(enum ClockSource source) {
 
     this->source = source;
     on_time = 0U;
-    interrupts();
+#ifdef MIDI_MERGE
+    // Stop spreading external edge's timing clocks (alarm is shared with PLL). Next edge is the first one
+    if (merge_remaining)
+        timebase.cancel_alarm(TIMEBASE_ALARM_CLOCK);
+    merge_remaining = 0U;
+    merge_pending = false;
+    merge_reset = true;
+#endif
+#ifdef CLOCK_PLL
+    pll_restart();
+#endif
+    SREG = sreg;
 }
 
 /**
- * @brief Counts midi ticks and sets output to ON if source is not NONE and N of ticks reached `divider` [0-4].
+ * @brief Counts midi ticks and sets output to ON on song position's `divider` [0-4] boundaries (if source is not NONE).
  * divider=0: 1/8 note, divider=1: 1/4 note, divider=2: 1/2 note, divider=3: whole note, divider=4: 2 notes.
- * NOTE: Will switch from EXT to MIDI mode automatically
+ * NOTE: Called from UART receive interrupt, so output edge doesn't depend on `loop()` timing.
+ * Will switch from EXT to MIDI mode automatically
+ *
+ * @param time timing clock byte arrival time (see timebase.h)
  */
-void Clock::midi_tick(void) {
+void Clock::midi_tick(uint32_t time) {
+    perf.counters.clock_in++;
     if (source == ClockSource::NONE)
         return;
     if (source == ClockSource::EXT)
         set_source(ClockSource::MIDI);
 
-    uint64_t time = millis();
+#ifdef CLOCK_JITTER_PROBE
+    // Pulse on every tick and measure time from interrupt entry to edge
+    write_output(true);
+    uint16_t latency = static_cast<uint16_t>(timebase.now() - time);
+    if (latency < probe_latency_min)
+        probe_latency_min = latency;
+    if (latency > probe_latency_max)
+        probe_latency_max = latency;
+    ticks_counter = 0U;
+    pulse();
+#else
+#ifdef CLOCK_PLL
+    // Tempo is tracked even while transport is stopped
+    pll_update(time);
+#endif
+
+    if (running) {
+        // `ticks_counter` is song position of this tick -> pulse on every divided note from the downbeat
+        boolean pulse_tick = ticks_counter % (((uint8_t) 1 << divider) * 12U) == 0U;
+        if (++ticks_counter >= CLOCK_TICKS_CYCLE)
+            ticks_counter = 0U;
+
+#ifdef CLOCK_PLL
+        if (pulse_tick) {
+            // Lock lost -> don't wait for PLL
+            if (pll_edge == PllEdge::PENDING && !pll_locked) {
+                timebase.cancel_alarm(TIMEBASE_ALARM_CLOCK);
+                pll_edge = PllEdge::NONE;
+            }
+
+            // Pulse was not scheduled by PLL -> set clock output to ON as fast as possible
+            if (pll_edge == PllEdge::NONE)
+                pulse();
+            else if (pll_edge == PllEdge::FIRED)
+                pll_edge = PllEdge::NONE;
+        } else {
+            if (pll_edge == PllEdge::PENDING)
+                timebase.cancel_alarm(TIMEBASE_ALARM_CLOCK);
+            pll_edge = PllEdge::NONE;
+        }
+
+        pll_schedule();
+#else
+        // Set clock output to ON as fast as possible and leave everything else to `loop()`
+        if (pulse_tick)
+            pulse();
+#endif
+    }
+#endif
+
     midi_tick_time_last = time;
+}
 
-    // Count ticks
-    if (ticks_counter < UINT8_MAX)
-        ticks_counter++;
+/**
+ * @brief Handles MIDI Start (rewinds to song position 0), Continue and Stop real-time messages.
+ * NOTE: Called from UART receive interrupt, so they take effect exactly between timing clock bytes
+ *
+ * @param data 0xFA (Start), 0xFB (Continue) or 0xFC (Stop). Other bytes are ignored
+ */
+void Clock::midi_transport(uint8_t data) {
+    if (data == 0xFAU) {
+        seek(0U);
+        running = true;
+    } else if (data == 0xFBU)
+        running = true;
+    else if (data == 0xFCU)
+        running = false;
     else
-        ticks_counter = 0U;
-    if (ticks_counter >= ((uint8_t) 1 << divider) * 12U)
-        ticks_counter = 0U;
+        return;
 
-    // Set event and clock output to ON
-    if (ticks_counter == 0U) {
-        clock_event = true;
-        write_output(true);
+#if defined(CLOCK_PLL) && !defined(CLOCK_JITTER_PROBE)
+    // Next tick is a downbeat -> schedule it on PLL's phase. Stop cancels scheduled pulse
+    if (pll_edge == PllEdge::PENDING)
+        timebase.cancel_alarm(TIMEBASE_ALARM_CLOCK);
+    pll_edge = PllEdge::NONE;
+    if (running && source == ClockSource::MIDI)
+        pll_schedule();
+#endif
+}
+
+/**
+ * @brief Tracks Song position pointer (0xF2 LSB MSB) in received stream and seeks to it. Must be called with every
+ * received byte except real-time ones. Bytes are still parsed by `midi` (to keep running status)
+ * NOTE: Called from UART receive interrupt, so new position is applied before following Continue
+ *
+ * @param data received byte
+ */
+void Clock::midi_song_position(uint8_t data) {
+    // Any status byte starts new message
+    if (data & 0x80U) {
+        song_position_index = data == 0xF2U ? 1U : 0U;
+        return;
     }
+
+    if (song_position_index == 1U) {
+        song_position_lsb = data;
+        song_position_index = 2U;
+    } else if (song_position_index == 2U) {
+        // Position is in MIDI beats (16th notes, 6 ticks each). Only phase within CLOCK_TICKS_CYCLE matters
+        uint16_t beats = (static_cast<uint16_t>(data) << 7U) | song_position_lsb;
+        seek(static_cast<uint8_t>((beats % (CLOCK_TICKS_CYCLE / 6U)) * 6U));
+        song_position_index = 0U;
+    }
+}
+
+/**
+ * @brief Sets song position of the next timing clock byte and restarts arpeggiators (see `transport_event`).
+ * Must be called with interrupts disabled
+ *
+ * @param ticks song position in ticks modulo CLOCK_TICKS_CYCLE
+ */
+void Clock::seek(uint8_t ticks) {
+    ticks_counter = ticks;
+    transport_event_midi = true;
 }
 
 /**
@@ -117,29 +264,66 @@ void Clock::loop(void) {
             ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { clock_event_ext = false; }
             clock_event = true;
         }
+#ifdef MIDI_MERGE
+        merge_schedule();
+#endif
+    }
+
+    // Handle MIDI Start / Song position pointer (from UART interrupt)
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (transport_event_midi) {
+            transport_event_midi = false;
+            transport_event = true;
+        }
     }
 
     if (source != ClockSource::MIDI)
         return;
 
-    uint64_t time = millis();
+    // Handle MIDI ticks (from UART interrupt)
+    boolean _clock_event_midi;
+    uint32_t _midi_tick_time_last;
+    uint64_t _on_time;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        _clock_event_midi = clock_event_midi;
+        clock_event_midi = false;
+        _midi_tick_time_last = midi_tick_time_last;
+        _on_time = on_time;
+    }
+    if (_clock_event_midi)
+        clock_event = true;
 
     // Switch to external mode on timeout
-    if (time - midi_tick_time_last > MIDI_CLOCK_TIMEOUT) {
-        midi_tick_time_last = 0U;
+    if (timebase.now() - _midi_tick_time_last > MIDI_CLOCK_TIMEOUT * 1000UL * TIMEBASE_TICKS_PER_US) {
         set_source(ClockSource::EXT);
+        return;
     }
 
     // Clock output is currently ON -> check if it's time to turn it OFF
-    if (on_time != 0U) {
+    if (_on_time != 0U) {
         uint64_t time = millis();
-        if (on_time > time || time - on_time >= CLOCK_HIGH_DURATION) {
-            on_time = 0U;
-            write_output(false);
+        if (_on_time > time || time - _on_time >= CLOCK_HIGH_DURATION) {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                // Make sure it was not restarted by interrupt
+                if (on_time == _on_time) {
+                    on_time = 0U;
+                    write_output(false);
+                }
+            }
         }
     }
 }
 
+/**
+ * @brief Starts MIDI clock output pulse and sets `clock_event_midi`. Must be called with interrupts disabled
+ */
+void Clock::pulse(void) {
+    perf.counters.clock_out++;
+    write_output(true);
+    clock_event_midi = true;
+    on_time = millis();
+}
+
 /**
  * @brief Sets clock output ON or OFF considering CLOCK_INVERTED
  *
@@ -160,9 +344,14 @@ void Clock::write_output(boolean state) {
 }
 
 /**
- * @brief Counts ticks into `ticks_counter_ext` and sets `clock_event_ext`
+ * @brief Counts ticks into `ticks_counter_ext` and sets `clock_event_ext` (and merges MIDI timing clocks into TX if
+ * MIDI_MERGE is defined)
  */
 void Clock::handle_interrupt(void) {
+#ifdef MIDI_MERGE
+    merge_edge();
+#endif
+
     if (ticks_counter_ext < UINT8_MAX)
         ticks_counter_ext++;
     else
@@ -178,3 +367,192 @@ void Clock::handle_interrupt(void) {
  * @brief Static interrupt callback (wrapper for `handle_interrupt()`)
  */
 void Clock::isr(void) { clock.handle_interrupt(); }
+
+#ifdef MIDI_MERGE
+/**
+ * @brief Sends the first MIDI timing clock of external clock edge right away and measures edge period for
+ * `merge_schedule()`. Must be called from external clock interrupt
+ */
+void Clock::merge_edge(void) {
+    uint32_t time = timebase.now();
+
+    // Clocks of previous edge that were not sent yet (tempo went up) are sent now, so every edge is still
+    // MIDI_MERGE_CLOCKS_PER_EDGE clocks (bytes that don't fit into real-time buffer are counted in `thru_dropped`)
+    if (merge_remaining) {
+        timebase.cancel_alarm(TIMEBASE_ALARM_CLOCK);
+        for (; merge_remaining; --merge_remaining)
+            uart.write_realtime(0xF8U);
+    }
+    uart.write_realtime(0xF8U);
+
+    merge_period = merge_reset ? 0U : time - merge_time;
+    merge_time = time;
+    merge_reset = false;
+    merge_pending = MIDI_MERGE_CLOCKS_PER_EDGE > 1U;
+}
+
+/**
+ * @brief Schedules the rest of the last external edge's timing clocks evenly over it's previous period (division is
+ * done here, in main loop). The first edge (or the one after MIDI_CLOCK_TIMEOUT) has no period, so only one clock is
+ * sent for it
+ */
+void Clock::merge_schedule(void) {
+    boolean pending;
+    uint32_t period, time;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        pending = merge_pending;
+        merge_pending = false;
+        period = merge_period;
+        time = merge_time;
+    }
+    if (!pending || period == 0U || period > MIDI_CLOCK_TIMEOUT * 1000UL * TIMEBASE_TICKS_PER_US)
+        return;
+
+    uint32_t interval = period / MIDI_MERGE_CLOCKS_PER_EDGE;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // Skip it if next edge came in the meantime (it will be scheduled on the next call)
+        if (!merge_pending && merge_time == time) {
+            merge_interval = interval;
+            merge_next = time + interval;
+            merge_remaining = MIDI_MERGE_CLOCKS_PER_EDGE - 1U;
+            timebase.set_alarm(TIMEBASE_ALARM_CLOCK, merge_next, merge_isr);
+        }
+    }
+}
+
+/**
+ * @brief Sends scheduled MIDI timing clock (and the following ones which time is too close to arm the alarm)
+ */
+void Clock::handle_merge_alarm(void) {
+    do {
+        uart.write_realtime(0xF8U);
+        merge_next += merge_interval;
+    } while (--merge_remaining &&
+             static_cast<int32_t>(timebase.now() - merge_next) > -TIMEBASE_ALARM_MIN_TICKS);
+
+    if (merge_remaining)
+        timebase.set_alarm(TIMEBASE_ALARM_CLOCK, merge_next, merge_isr);
+}
+
+/**
+ * @brief Static alarm callback (wrapper for `handle_merge_alarm()`)
+ */
+void Clock::merge_isr(void) { clock.handle_merge_alarm(); }
+#endif
+
+#ifdef CLOCK_PLL
+/**
+ * @brief Calculates tempo estimated by PLL
+ *
+ * @return uint16_t BPM * 10 (ex. 1200 = 120.0 BPM) or 0 if there is no estimation yet
+ */
+uint16_t Clock::get_bpm(void) {
+    uint32_t period;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { period = pll_period >> 8U; }
+    if (period == 0U)
+        return 0U;
+
+    // 24 ticks per quarter note
+    return static_cast<uint16_t>((60000000UL * TIMEBASE_TICKS_PER_US * 10UL / 24UL) / period);
+}
+
+/**
+ * @brief Calculates residual jitter (filtered absolute phase error) of incoming ticks relative to PLL's phase
+ *
+ * @return uint16_t jitter in microseconds
+ */
+uint16_t Clock::get_jitter(void) {
+    uint32_t jitter;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { jitter = pll_jitter; }
+    return static_cast<uint16_t>((jitter >> 4U) / TIMEBASE_TICKS_PER_US);
+}
+
+/**
+ * @brief Resets PLL into unlocked state and cancels scheduled pulse. Must be called with interrupts disabled
+ */
+void Clock::pll_restart(void) {
+    if (pll_edge == PllEdge::PENDING)
+        timebase.cancel_alarm(TIMEBASE_ALARM_CLOCK);
+    pll_edge = PllEdge::NONE;
+    pll_reset = true;
+    pll_locked = false;
+    pll_lock_counter = 0U;
+    pll_period = 0U;
+    pll_jitter = 0U;
+}
+
+/**
+ * @brief Second-order PLL. Estimates tick period (`pll_period`, Q24.8 timebase ticks) and predicts next tick time
+ * (`pll_next`) from incoming tick timestamps
+ *
+ * @param time timing clock byte arrival time (see timebase.h)
+ */
+void Clock::pll_update(uint32_t time) {
+    uint32_t interval = time - pll_time_last;
+    pll_time_last = time;
+
+    // 1st tick -> nothing to measure yet
+    if (pll_reset) {
+        pll_reset = false;
+        return;
+    }
+
+    int32_t error = static_cast<int32_t>(time - pll_next);
+    uint32_t error_abs = static_cast<uint32_t>(error < 0 ? -error : error);
+    uint32_t period = pll_period >> 8U;
+
+    // 2nd tick or phase is way off -> start from raw interval
+    if (period == 0U || error_abs > (period >> 1U)) {
+        pll_period = interval << 8U;
+        pll_next = time + interval;
+        pll_locked = false;
+        pll_lock_counter = 0U;
+        return;
+    }
+
+    // Phase (proportional) and frequency (integral) corrections
+    pll_next += period + (error >> pll_bandwidth);
+    pll_period += (error * 256L) >> (2U * pll_bandwidth + 1U);
+
+    // Residual jitter (Q4)
+    int32_t jitter = static_cast<int32_t>(pll_jitter);
+    pll_jitter = static_cast<uint32_t>(jitter + ((static_cast<int32_t>(error_abs << 4U) - jitter) >> 4U));
+
+    // Lock detection with hysteresis
+    if (error_abs < (period >> 3U)) {
+        if (pll_lock_counter < CLOCK_PLL_LOCK_TICKS)
+            pll_lock_counter++;
+        else
+            pll_locked = true;
+    } else if (error_abs > (period >> 2U)) {
+        pll_lock_counter = 0U;
+        pll_locked = false;
+    }
+}
+
+/**
+ * @brief Schedules pulse at PLL's predicted time if PLL is locked and next tick is at divided note boundary.
+ * Must be called with interrupts disabled
+ */
+void Clock::pll_schedule(void) {
+    if (pll_locked && ticks_counter % (((uint8_t) 1 << divider) * 12U) == 0U) {
+        pll_edge = PllEdge::PENDING;
+        timebase.set_alarm(TIMEBASE_ALARM_CLOCK, pll_next, pll_isr);
+    }
+}
+
+/**
+ * @brief Starts scheduled pulse on PLL's phase
+ */
+void Clock::handle_pll_alarm(void) {
+    if (pll_edge != PllEdge::PENDING)
+        return;
+    pulse();
+    pll_edge = PllEdge::FIRED;
+}
+
+/**
+ * @brief Static alarm callback (wrapper for `handle_pll_alarm()`)
+ */
+void Clock::pll_isr(void) { clock.handle_pll_alarm(); }
+#endif
@@ -27,16 +27,111 @@
 
 #include "include/dac.h"
 #include "include/calibration.h"
+#include "include/glide.h"
+#include "include/mod.h"
+#include "include/perf.h"
 #include "include/pins.h"
+#include "include/timebase.h"
 #include "include/utils.h"
+#include "include/vcc.h"
 
 #include <SPI.h>
+#include <util/atomic.h>
+
+#if defined(DAC_DITHER) && !defined(DAC_ENGINE)
+#error "DAC_DITHER requires DAC_ENGINE"
+#endif
+#if DAC_DITHER_BITS != 8U
+#error "DAC_DITHER_BITS must be 8 (fractions are stored as uint8_t)"
+#endif
+
+#ifdef DAC_ENGINE
+#if DAC_ENGINE_OCR < 1UL || DAC_ENGINE_OCR > 255UL
+#error "DAC_ENGINE_RATE_HZ is out of Timer2 range"
+#endif
+#if DAC_ENGINE_RATE_HZ > DAC_ENGINE_RATE_HZ_MAX
+#error "DAC_ENGINE_RATE_HZ is over interrupt budget (DAC_ENGINE_RATE_HZ_MAX)"
+#endif
+
+// CPU cycles per timebase tick (ISR profiling resolution)
+#define DAC_ENGINE_CYCLES_PER_TICK (F_CPU / 1000000UL / TIMEBASE_TICKS_PER_US)
+#endif
 
 // Preinstantiate
 DAC dac;
 
 /**
- * @brief Initialised DAC pins, SPI as master and ADC to measure VCC
+ * @brief Calculates fixed-point gain factor (DAC codes per Q14.2 mV per VCC ADC unit)
+ *
+ * @param gain DAC amplifier gain (including calibration offset)
+ * @return uint32_t gain factor (see DAC_SCALE_SHIFT and DAC_GAIN_SHIFT)
+ */
+static uint32_t gain_to_factor(float gain) {
+    float factor = static_cast<float>(DAC_MAX) / (static_cast<float>(MV_Q2_ONE) * INTERNAL_VREF_MV * 1023.f * gain);
+    return static_cast<uint32_t>(factor * static_cast<float>(1UL << (DAC_SCALE_SHIFT + DAC_GAIN_SHIFT)) + .5f);
+}
+
+#ifdef DAC_DITHER
+/**
+ * @brief First-order sigma-delta modulator (error feedback). Adds 1 to DAC code whenever accumulated fractional part
+ * overflows, so average output is code + fraction / 2^DAC_DITHER_BITS and quantization error is pushed to high
+ * frequencies (where VCO's CV input filter removes it). ~15 cycles (estimated from instruction counts)
+ *
+ * @param value DAC code
+ * @param fraction fractional part of DAC code
+ * @param error accumulated error of channel
+ * @return uint16_t dithered DAC code
+ */
+static inline uint16_t dither(uint16_t value, uint8_t fraction, uint8_t &error) {
+    uint16_t sum = static_cast<uint16_t>(error) + fraction;
+    error = sum;
+    return ((sum >> DAC_DITHER_BITS) && value < DAC_MAX) ? value + 1U : value;
+}
+#endif
+
+/**
+ * @brief Starts shifting byte into shift registers and latches previous one as soon as it's shifted out. Latch of
+ * this byte is pulled low while it's being shifted (only rising edge latches data), so SPI is idle only for a few
+ * cycles between bytes instead of the whole `SPI.transfer()` overhead. Call `spi_finish()` after the last byte
+ *
+ * @param data byte to shift
+ * @param port_out_reg latch output register of this byte
+ * @param mask latch mask of this byte
+ * @param latch_reg latch output register of previous byte (NULL if it's the first one). Set to port_out_reg
+ * @param latch_mask latch mask of previous byte. Set to mask
+ */
+static inline void spi_shift(uint8_t data, volatile uint8_t *port_out_reg, uint8_t mask, volatile uint8_t *&latch_reg,
+                             uint8_t &latch_mask) {
+    if (latch_reg) {
+        while (!(SPSR & _BV(SPIF)))
+            ;
+        *latch_reg |= latch_mask;
+    }
+    SPDR = data;
+    *port_out_reg &= ~mask;
+    latch_reg = port_out_reg;
+    latch_mask = mask;
+}
+
+/**
+ * @brief Waits for the last byte to be shifted out and latches it
+ *
+ * @param latch_reg latch output register of the last byte (NULL if nothing was shifted)
+ * @param latch_mask latch mask of the last byte
+ */
+static inline void spi_finish(volatile uint8_t *latch_reg, uint8_t latch_mask) {
+    if (!latch_reg)
+        return;
+    while (!(SPSR & _BV(SPIF)))
+        ;
+    *latch_reg |= latch_mask;
+
+    // Clear SPIF (SPSR was read with SPIF set, now access SPDR)
+    (void) SPDR;
+}
+
+/**
+ * @brief Initialised DAC pins and SPI as master (VCC is measured by `vcc`, see vcc.h)
  */
 void DAC::init(void) {
     // Latches
@@ -58,24 +153,36 @@ void DAC::init(void) {
     SPI.setDataMode(SPI_MODE0);
     SPI.setClockDivider(SPI_CLOCK_DIV2);
 
-    // Make first write
-    write();
+    // Make first write (all registers)
+    latched = false;
+    output(frame.value_1, frame.value_2);
 
-    // Set the Vref to Vcc and the measurement to the internal 1.1V reference
-#if defined(__AVR_ATmega32U4__) || defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
-    ADMUX = _BV(REFS0) | _BV(MUX4) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
-#elif defined(__AVR_ATtiny24__) || defined(__AVR_ATtiny44__) || defined(__AVR_ATtiny84__)
-    ADMUX = _BV(MUX5) | _BV(MUX0);
-#else
-    ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
+#ifdef DAC_ENGINE
+    // Timer2 in CTC mode @ F_CPU / 64, compare A interrupt at DAC_ENGINE_RATE_HZ
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        frame_front = 0U;
+        frames[0].value_1 = frame.value_1;
+        frames[0].value_2 = frame.value_2;
+#ifdef DAC_DITHER
+        frames[0].fraction_1 = 0U;
+        frames[0].fraction_2 = 0U;
+#endif
+#ifdef GLIDE
+        frames[0].glide_step_1 = 0U;
+        frames[0].glide_step_2 = 0U;
+#endif
+        TCCR2A = _BV(WGM21);
+        TCCR2B = _BV(CS22);
+        TCNT2 = 0U;
+        OCR2A = DAC_ENGINE_OCR;
+        TIFR2 = _BV(OCF2A);
+        TIMSK2 = _BV(OCIE2A);
+    }
 #endif
 
-    // Wait for VRef to settle
-    delay(20);
-
-    // Make first VCC reading
-    calculate_compensation();
-    write();
+    // Force gain factors calculation
+    gain_1_offset_last = NAN;
+    gain_2_offset_last = NAN;
 }
 
 /**
@@ -86,57 +193,182 @@ void DAC::init(void) {
  */
 void DAC::set(float target_1, float target_2) {
     if (!isnanf(target_1))
-        dac_1_target = target_1 >= 0.f ? target_1 : 0.f;
+        dac_1_target = target_1 >= 0.f ? static_cast<uint16_t>(target_1 * static_cast<float>(MV_Q2_ONE) + .5f) : 0U;
     if (!isnanf(target_2))
-        dac_2_target = target_2 >= 0.f ? target_2 : 0.f;
+        dac_2_target = target_2 >= 0.f ? static_cast<uint16_t>(target_2 * static_cast<float>(MV_Q2_ONE) + .5f) : 0U;
+}
+
+/**
+ * @brief Sets DAC target output voltages in fixed-point without doing any actual writes to DAC
+ *
+ * @param target_1 1st channel target in Q14.2 mV (see MV_Q2_ONE). DAC_KEEP to not change
+ * @param target_2 2nd channel target in Q14.2 mV (see MV_Q2_ONE). DAC_KEEP to not change
+ */
+void DAC::set_mv_q2(uint16_t target_1, uint16_t target_2) {
+    if (target_1 != DAC_KEEP)
+        dac_1_target = target_1;
+    if (target_2 != DAC_KEEP)
+        dac_2_target = target_2;
 }
 
 /**
- * @brief Writes calculated DAC values using SPI.
+ * @brief Writes calculated DAC values (or hands them to DAC_ENGINE to be latched on it's next tick).
  * NOTE: This must be called in `loop()` immediately after calculate_compensation()
  */
-void DAC::write(void) {
+void DAC::write(void) { write_frame(frame); }
+
+/**
+ * @brief Writes DAC values calculated earlier (see `get_frame()`) or hands them to DAC_ENGINE. Only copies them,
+ * so it's safe to call from interrupt (see PLAYOUT)
+ *
+ * @param frame_ calculated DAC values
+ */
+void DAC::write_frame(const struct dacFrame &frame_) {
+#ifdef DAC_ENGINE
+    // Timer2 interrupt reads only front frame, so back one can be filled without disabling interrupts.
+    // NOTE: must not be called from main loop and interrupt at the same time (see PLAYOUT)
+    uint8_t back = frame_front ^ 1U;
+    frames[back].value_1 = frame_.value_1;
+    frames[back].value_2 = frame_.value_2;
+#ifdef DAC_DITHER
+    frames[back].fraction_1 = frame_.fraction_1;
+    frames[back].fraction_2 = frame_.fraction_2;
+#endif
+#ifdef GLIDE
+    frames[back].glide_step_1 = frame_.glide_step_1;
+    frames[back].glide_step_2 = frame_.glide_step_2;
+    frames[back].glide_exponential = frame_.glide_exponential;
+#endif
+    frame_front = back;
+#else
+    output(frame_.value_1, frame_.value_2);
+#endif
+}
+
+/**
+ * @brief Writes DAC values using SPI. Only shift registers which contents changed are shifted and latched,
+ * so unchanged channel is not touched (except shared middle register, if other channel's lowest 4 bits changed).
+ * Bytes are pipelined (see `spi_shift()`): full two-channel update takes ~70 cycles instead of ~125 with
+ * `SPI.transfer()` (estimated from instruction counts, 48 cycles is the limit @ SPI_CLOCK_DIV2). Build with PERF_PROBES
+ * to measure it (`DAC_OUTPUT` probe, see perf.h)
+ *
+ * @param value_1 1st channel DAC code
+ * @param value_2 2nd channel DAC code
+ */
+void DAC::output(uint16_t value_1, uint16_t value_2) {
+#ifdef PERF_PROBES
+    uint16_t start = TCNT1;
+#endif
+    volatile uint8_t *latch_reg = NULL;
+    uint8_t latch_mask = 0U;
+    uint8_t skipped = 0U;
+
     // Send lowest 8 bits of first dac value
-    *dac_1_port_out_reg &= ~dac_1_mask;
-    SPI.transfer(dac_1_value & 0xFF);
-    *dac_1_port_out_reg |= dac_1_mask;
+    uint8_t register_1 = value_1 & 0xFF;
+    if (!latched || register_1 != latched_1) {
+        spi_shift(register_1, dac_1_port_out_reg, dac_1_mask, latch_reg, latch_mask);
+        latched_1 = register_1;
+    } else
+        ++skipped;
 
-    // Send highest 4 bits of first dac value and lowest 4 bits of second dac value
-    *dac_2_port_out_reg &= ~dac_2_mask;
-    SPI.transfer(((dac_1_value >> 8) & 0xFF) | (((dac_2_value & 0b00001111) << 4) & 0xFF));
-    *dac_2_port_out_reg |= dac_2_mask;
+    // Send highest 4 bits of first dac value and lowest 4 bits of second dac value (prepared while previous byte is
+    // being shifted)
+    uint8_t register_2 = ((value_1 >> 8) & 0b00001111) | ((value_2 & 0b00001111) << 4);
+    if (!latched || register_2 != latched_2) {
+        spi_shift(register_2, dac_2_port_out_reg, dac_2_mask, latch_reg, latch_mask);
+        latched_2 = register_2;
+    } else
+        ++skipped;
 
     // Send highest 8 bits of second dac value
-    *dac_3_port_out_reg &= ~dac_3_mask;
-    SPI.transfer((dac_2_value >> 4) & 0xFF);
-    *dac_3_port_out_reg |= dac_3_mask;
+    uint8_t register_3 = (value_2 >> 4) & 0xFF;
+    if (!latched || register_3 != latched_3) {
+        spi_shift(register_3, dac_3_port_out_reg, dac_3_mask, latch_reg, latch_mask);
+        latched_3 = register_3;
+    } else
+        ++skipped;
+
+    spi_finish(latch_reg, latch_mask);
+    latched = true;
+#ifdef PERF_PROBES
+    // Only full two-channel updates (all 3 registers shifted and latched)
+    if (!skipped)
+        perf.probe(PerfProbe::DAC_OUTPUT, TCNT1 - start);
+#endif
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        perf.counters.dac_latched += 3U - skipped;
+        perf.counters.dac_skipped += skipped;
+    }
 }
 
 /**
- * @brief Measures VCC and calculates compensated raw DAC values considering DAC gains (and offsets from calibration).
- * NOTE: This must be called in `loop()` before `write()` and as fast as possible
+ * @brief Calculates compensated raw DAC values considering DAC gains (and offsets from calibration) and the latest
+ * filtered VCC measurement (see vcc.h). Scales are recalculated only when VCC or gain calibration changes, so usually
+ * it's just one multiplication per DAC. Glide steps and modulation parameters (see glide.h and mod.h) are calculated
+ * here as well, because they need divisions and floats. NOTE: This must be called in `loop()` before `write()`
+ * (after `vcc.init()`)
  */
 void DAC::calculate_compensation(void) {
-    // Start ADC conversion and measure 1.1V reference against AVcc
-    ADCSRA |= _BV(ADSC);
-    while (bit_is_set(ADCSRA, ADSC))
-        ;
+    uint16_t vcc_filtered_ = vcc.get();
+    boolean changed = vcc_filtered_ != vcc_filtered;
 
-    // Read result and calculate VCC in millivolts
-    vcc_raw = ADCL | (ADCH << 8);
-    vcc = (INTERNAL_VREF_MV * 1023.f) / static_cast<float>(vcc_raw);
+    // Gain calibration changed (rarely) -> recalculate gain factors
+    if (calibration.gain_1_offset != gain_1_offset_last) {
+        gain_1_offset_last = calibration.gain_1_offset;
+        gain_1_factor = gain_to_factor(GAIN_1_BASE + gain_1_offset_last);
+        changed = true;
+    }
+    if (calibration.gain_2_offset != gain_2_offset_last) {
+        gain_2_offset_last = calibration.gain_2_offset;
+        gain_2_factor = gain_to_factor(GAIN_2_BASE + gain_2_offset_last);
+        changed = true;
+    }
 
-    // Calculate gains and compensate for VCC
-    dac_1_value = map_f(dac_1_target, 0.f, vcc * (GAIN_1_BASE + calibration.gain_1_offset), 0.f, DAC_MAX);
-    dac_2_value = map_f(dac_2_target, 0.f, vcc * (GAIN_2_BASE + calibration.gain_2_offset), 0.f, DAC_MAX);
+    // Compensate gains for VCC (VCC = INTERNAL_VREF_MV * 1023 / raw ADC value, so scale is proportional to it)
+    if (changed) {
+        vcc_filtered = vcc_filtered_;
+        dac_1_scale = (static_cast<uint32_t>(vcc_filtered) * gain_1_factor + _BV(DAC_VCC_SHIFT - 1U)) >> DAC_VCC_SHIFT;
+        dac_2_scale = (static_cast<uint32_t>(vcc_filtered) * gain_2_factor + _BV(DAC_VCC_SHIFT - 1U)) >> DAC_VCC_SHIFT;
+    }
 
-    // Clamp to maximum possible value
-    if (dac_1_value > DAC_MAX)
-        dac_1_value = DAC_MAX;
-    if (dac_2_value > DAC_MAX)
-        dac_2_value = DAC_MAX;
+    // Convert and clamp to maximum possible value
+#ifdef DAC_DITHER
+    // Keep DAC_DITHER_BITS of fractional part
+    uint32_t value_1 = (static_cast<uint32_t>(dac_1_target) * dac_1_scale) >> (DAC_SCALE_SHIFT - DAC_DITHER_BITS);
+    uint32_t value_2 = (static_cast<uint32_t>(dac_2_target) * dac_2_scale) >> (DAC_SCALE_SHIFT - DAC_DITHER_BITS);
+    if (value_1 >= (static_cast<uint32_t>(DAC_MAX) << DAC_DITHER_BITS))
+        value_1 = static_cast<uint32_t>(DAC_MAX) << DAC_DITHER_BITS;
+    if (value_2 >= (static_cast<uint32_t>(DAC_MAX) << DAC_DITHER_BITS))
+        value_2 = static_cast<uint32_t>(DAC_MAX) << DAC_DITHER_BITS;
+    frame.value_1 = value_1 >> DAC_DITHER_BITS;
+    frame.value_2 = value_2 >> DAC_DITHER_BITS;
+    frame.fraction_1 = value_1;
+    frame.fraction_2 = value_2;
+#else
+    uint32_t value_1 = (static_cast<uint32_t>(dac_1_target) * dac_1_scale) >> DAC_SCALE_SHIFT;
+    uint32_t value_2 = (static_cast<uint32_t>(dac_2_target) * dac_2_scale) >> DAC_SCALE_SHIFT;
+    frame.value_1 = value_1 > DAC_MAX ? DAC_MAX : value_1;
+    frame.value_2 = value_2 > DAC_MAX ? DAC_MAX : value_2;
+#endif
+
+#ifdef GLIDE
+    frame.glide_step_1 = glide.update(0U, dac_1_target, frame.value_1, dac_1_scale);
+    frame.glide_step_2 = glide.update(1U, dac_2_target, frame.value_2, dac_2_scale);
+    frame.glide_exponential = glide.curve == GlideCurve::EXPONENTIAL;
+#endif
+#ifdef MOD
+    mod.update(dac_1_scale, dac_2_scale);
+#endif
 }
 
+/**
+ * @brief Copies DAC values calculated by `calculate_compensation()` to be written later by `write_frame()`
+ *
+ * @param frame_ calculated DAC values
+ */
+void DAC::get_frame(struct dacFrame &frame_) { frame_ = frame; }
+
 /**
  * @brief Calculates current highest possible output voltage.
  * NOTE: call calculate_compensation() before it at least ones to measure VCC
@@ -145,5 +377,57 @@ void DAC::calculate_compensation(void) {
  * @return float maximum possible output voltage in millivolts
  */
 float DAC::get_current_maximum(uint8_t dac) {
-    return vcc * ((dac ? GAIN_2_BASE : GAIN_1_BASE) + (dac ? calibration.gain_2_offset : calibration.gain_1_offset));
+    float vcc_mv = (INTERNAL_VREF_MV * 1023.f * _BV(VCC_FRACTION_BITS)) / static_cast<float>(vcc_filtered);
+    return vcc_mv * ((dac ? GAIN_2_BASE : GAIN_1_BASE) + (dac ? calibration.gain_2_offset : calibration.gain_1_offset));
 }
+
+#ifdef DAC_ENGINE
+/**
+ * @brief Latches front frame (moves glide one sample towards it and adds modulation if GLIDE / MOD are enabled).
+ * Measures it's own duration (without interrupt entry / exit, in timebase ticks) and reports max duration and CPU load
+ * over every second into performance counters
+ */
+void DAC::handle_tick(void) {
+    uint16_t start = TCNT1;
+
+    volatile struct dacFrame &front = frames[frame_front];
+    uint16_t value_1 = front.value_1, value_2 = front.value_2;
+#ifdef DAC_DITHER
+    uint8_t fraction_1 = front.fraction_1, fraction_2 = front.fraction_2;
+#elif defined(GLIDE)
+    uint8_t fraction_1 = 0U, fraction_2 = 0U;
+#endif
+#ifdef GLIDE
+    glide.tick(0U, value_1, fraction_1, front.glide_step_1, front.glide_exponential);
+    glide.tick(1U, value_2, fraction_2, front.glide_step_2, front.glide_exponential);
+#endif
+#ifdef MOD
+    mod.tick(value_1, value_2);
+#if defined(MOD_ADSR) && defined(DAC_DITHER)
+    fraction_2 = 0U;
+#endif
+#endif
+#ifdef DAC_DITHER
+    value_1 = dither(value_1, fraction_1, dither_error_1);
+    value_2 = dither(value_2, fraction_2, dither_error_2);
+#endif
+    output(value_1, value_2);
+
+    uint16_t ticks = TCNT1 - start;
+    isr_ticks += ticks;
+    if (ticks * DAC_ENGINE_CYCLES_PER_TICK > perf.counters.dac_isr_max)
+        perf.counters.dac_isr_max = ticks * DAC_ENGINE_CYCLES_PER_TICK;
+
+    // Load in 0.01% (isr_ticks per second / ticks per second * 10000)
+    if (++isr_count >= DAC_ENGINE_RATE_HZ) {
+        perf.counters.dac_isr_load = isr_ticks / (TIMEBASE_TICKS_PER_US * 100UL);
+        isr_ticks = 0U;
+        isr_count = 0U;
+    }
+}
+
+/**
+ * @brief Timer2 compare A interrupt (wrapper for `handle_tick()`)
+ */
+ISR(TIMER2_COMPA_vect) { dac.handle_tick(); }
+#endif
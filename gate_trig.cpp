@@ -28,6 +28,8 @@
 #include "include/gate_trig.h"
 #include "include/pins.h"
 
+#include <util/atomic.h>
+
 // Preinstantiate
 GateTrig gate_trig;
 
@@ -57,17 +59,35 @@ void GateTrig::init(void) {
  * @brief Stops trig pulse after TRIG_1_DURATION / TRIG_2_DURATION
  */
 void GateTrig::loop(void) {
+    // Trigger pulses started by `release()` are timed from here
+    uint8_t released;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        released = trigs_released;
+        trigs_released = 0U;
+    }
+    if (released & 0x01U)
+        trig_1_timer = millis();
+    if (released & 0x02U)
+        trig_2_timer = millis();
+
     if (trig_1_timer == 0U && trig_2_timer == 0U)
         return;
 
     uint64_t time = millis();
 
+    // Pulse could be restarted by `release()` interrupt in the meantime
     if (trig_1_timer > time || time - trig_1_timer >= TRIG_1_DURATION) {
-        trig_1_write(false);
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            if (!(trigs_released & 0x01U))
+                trig_1_write(false);
+        }
         trig_1_timer = 0;
     }
     if (trig_2_timer > time || time - trig_2_timer >= TRIG_2_DURATION) {
-        trig_2_write(false);
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            if (!(trigs_released & 0x02U))
+                trig_2_write(false);
+        }
         trig_2_timer = 0;
     }
 }
@@ -79,10 +99,20 @@ void GateTrig::loop(void) {
  * @param from_self internal parameter, used for merging gates and triggers
  */
 void GateTrig::set_1(boolean state, boolean from_self) {
-    gate_1_write(state);
-    if (state) {
-        trig_1_write(true);
-        trig_1_timer = millis();
+    // Atomic, because `release()` can be called from interrupt
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (held) {
+            gate_1_state = state;
+            if (state)
+                trigs_held |= 0x01U;
+        } else {
+            gate_1_state = state;
+            gate_1_write(state);
+            if (state) {
+                trig_1_write(true);
+                trig_1_timer = millis();
+            }
+        }
     }
     if (!from_self && merged)
         set_2(state, true);
@@ -95,22 +125,78 @@ void GateTrig::set_1(boolean state, boolean from_self) {
  * @param from_self internal parameter, used for merging gates and triggers
  */
 void GateTrig::set_2(boolean state, boolean from_self) {
-    gate_2_write(state);
-    if (state) {
-        trig_2_write(true);
-        trig_2_timer = millis();
+    // Atomic, because `release()` can be called from interrupt
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (held) {
+            gate_2_state = state;
+            if (state)
+                trigs_held |= 0x02U;
+        } else {
+            gate_2_state = state;
+            gate_2_write(state);
+            if (state) {
+                trig_2_write(true);
+                trig_2_timer = millis();
+            }
+        }
     }
     if (!from_self && merged)
         set_1(state, true);
 }
 
+/**
+ * @brief Packs current gates and triggers started since previous snapshot while `held` is true (for `play()`)
+ *
+ * @return uint8_t gates in bits 0-1 and triggers in bits 2-3
+ */
+uint8_t GateTrig::snapshot(void) {
+    uint8_t snapshot_;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        snapshot_ = (gate_1_state ? 0x01U : 0U) | (gate_2_state ? 0x02U : 0U) | (trigs_held << 2U);
+        trigs_held = 0U;
+    }
+    return snapshot_;
+}
+
+/**
+ * @brief Writes gates and starts triggers of snapshot (at once). Keeps holding them.
+ * NOTE: Called from interrupt (see playout.h)
+ *
+ * @param snapshot result of `snapshot()`
+ */
+void GateTrig::play(uint8_t snapshot) {
+    gate_1_write(snapshot & 0x01U);
+    gate_2_write(snapshot & 0x02U);
+    uint8_t trigs = snapshot >> 2U;
+    if (trigs & 0x01U)
+        trig_1_write(true);
+    if (trigs & 0x02U)
+        trig_2_write(true);
+    trigs_released |= trigs;
+}
+
+/**
+ * @brief Writes gates and starts triggers set while `held` was true (at once) and stops holding them.
+ * NOTE: Called from interrupt (see playout.h)
+ */
+void GateTrig::release(void) {
+    gate_1_write(gate_1_state);
+    gate_2_write(gate_2_state);
+    if (trigs_held & 0x01U)
+        trig_1_write(true);
+    if (trigs_held & 0x02U)
+        trig_2_write(true);
+    trigs_released |= trigs_held;
+    trigs_held = 0U;
+    held = false;
+}
+
 /**
  * @brief Writes gate 1 port
  *
  * @param state true to ON, false to OFF
  */
 void GateTrig::gate_1_write(boolean state) {
-    gate_1_state = state;
 #ifdef GATE_1_INVERTED
     if (state)
         *gate_1_out_reg &= ~gate_1_pin_mask;
@@ -130,7 +216,6 @@ void GateTrig::gate_1_write(boolean state) {
  * @param state true to ON, false to OFF
  */
 void GateTrig::gate_2_write(boolean state) {
-    gate_2_state = state;
 #ifdef GATE_2_INVERTED
     if (state)
         *gate_2_out_reg &= ~gate_2_pin_mask;
@@ -0,0 +1,190 @@
+/**
+ * @file glide.cpp
+ * @author Fern Lane
+ * @brief Digital glide (portamento) of DAC codes in DAC_ENGINE interrupt
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "include/glide.h"
+#include "include/dac.h"
+#include "include/utils.h"
+
+#include <util/atomic.h>
+
+#if defined(GLIDE) && !defined(DAC_ENGINE)
+#error "GLIDE requires DAC_ENGINE (see include/dac.h)"
+#endif
+
+// Preinstantiate
+Glide glide;
+
+/**
+ * @brief Sets default mode, curve and ON / OFF state of both channels (glide time is 0)
+ */
+void Glide::init(void) {
+    set_mode(GLIDE_MODE, GLIDE_CURVE);
+    set_enabled(0U, GLIDE_ENABLED_DEFAULT);
+    set_enabled(1U, GLIDE_ENABLED_DEFAULT);
+}
+
+/**
+ * @brief Sets glide time of channel (applies to the next glide)
+ *
+ * @param channel 0 or 1
+ * @param value MIDI CC5 value (0-127, see GLIDE_TIME_MAX_MS)
+ */
+void Glide::set_time(uint8_t channel, uint8_t value) {
+    time_ms[channel] = (GLIDE_TIME_MAX_MS * value * value) / (127UL * 127UL);
+    changed[channel] = true;
+}
+
+/**
+ * @brief Turns glide of channel ON or OFF (applies to the next glide)
+ *
+ * @param channel 0 or 1
+ * @param enabled_ false to jump to new targets
+ */
+void Glide::set_enabled(uint8_t channel, boolean enabled_) {
+    enabled[channel] = enabled_;
+    changed[channel] = true;
+}
+
+/**
+ * @brief Sets glide mode and curve of both channels (applies to the next glide)
+ *
+ * @param mode_ GlideMode::CONSTANT_TIME or GlideMode::CONSTANT_RATE
+ * @param curve_ GlideCurve::LINEAR or GlideCurve::EXPONENTIAL
+ */
+void Glide::set_mode(enum GlideMode mode_, enum GlideCurve curve_) {
+    mode = mode_;
+    curve = curve_;
+    changed[0] = true;
+    changed[1] = true;
+}
+
+/**
+ * @brief Calculates glide step of channel when it's target changes. Must be called from main loop
+ * (see `DAC::calculate_compensation()`) and it's result must be passed to `tick()`
+ *
+ * @param channel 0 or 1
+ * @param target DAC target in Q14.2 mV (after calibration, see `DAC::set()`). Glide starts when it changes
+ * @param code compensated DAC code of target
+ * @param scale DAC scale (DAC codes per Q14.2 mV in Q0.16, see DAC_SCALE_SHIFT)
+ * @return uint32_t glide step for `tick()`
+ */
+uint32_t Glide::update(uint8_t channel, uint16_t target, uint16_t code, uint16_t scale) {
+    if (target != target_last[channel] || changed[channel]) {
+        target_last[channel] = target;
+        changed[channel] = false;
+        step[channel] = calculate_step(channel, code, scale);
+    }
+    return step[channel];
+}
+
+/**
+ * @brief Calculates glide step from the current position (floats are used only here, once per glide)
+ *
+ * @param channel 0 or 1
+ * @param code compensated DAC code of target
+ * @param scale DAC scale (DAC codes per Q14.2 mV in Q0.16, see DAC_SCALE_SHIFT)
+ * @return uint32_t Q12.16 DAC codes per sample (LINEAR) or Q0.16 fraction of remaining distance per sample
+ * (EXPONENTIAL). 0 to jump to target
+ */
+uint32_t Glide::calculate_step(uint8_t channel, uint16_t code, uint16_t scale) {
+    if (!enabled[channel] || time_ms[channel] == 0U)
+        return 0U;
+
+    uint32_t samples = (static_cast<uint32_t>(time_ms[channel]) * DAC_ENGINE_RATE_HZ) / 1000UL;
+    if (samples == 0U)
+        return 0U;
+
+    // Distance from current position and DAC codes per 1V (both in Q12.16)
+    uint32_t position_;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { position_ = position[channel]; }
+    uint32_t target = static_cast<uint32_t>(code) << 16U;
+    uint32_t distance = target > position_ ? target - position_ : position_ - target;
+    uint32_t volt = static_cast<uint32_t>(MV_Q2_ONE) * 1000UL * scale;
+
+    if (curve == GlideCurve::LINEAR) {
+        uint32_t step_ = (mode == GlideMode::CONSTANT_TIME ? distance : volt) / samples;
+        return step_ ? step_ : 1U;
+    }
+
+    // Exponential: fraction of remaining distance per sample = 1 - e^(-time constants / samples)
+    float samples_f = static_cast<float>(samples);
+    if (mode == GlideMode::CONSTANT_RATE)
+        samples_f *= static_cast<float>(distance) / static_cast<float>(volt);
+    if (samples_f < 1.f)
+        return UINT16_MAX;
+    uint32_t coefficient = static_cast<uint32_t>((1.f - expf(-GLIDE_EXP_TIME_CONSTANTS / samples_f)) * 65536.f + .5f);
+    return coefficient < 1U ? 1U : (coefficient > UINT16_MAX ? UINT16_MAX : coefficient);
+}
+
+/**
+ * @brief Moves channel's position one sample towards target. Must be called from DAC_ENGINE interrupt only.
+ * Fixed-point only: ~35 cycles per channel for linear curve, ~80 for exponential (estimated from instruction counts)
+ *
+ * @param channel 0 or 1
+ * @param code compensated DAC code of target. Replaced with DAC code to output
+ * @param fraction fractional part of target DAC code (see DAC_DITHER). Replaced with fractional part of output
+ * @param step result of `update()`
+ * @param exponential true if step was calculated for GlideCurve::EXPONENTIAL
+ */
+void Glide::tick(uint8_t channel, uint16_t &code, uint8_t &fraction, uint32_t step, boolean exponential) {
+    uint32_t target =
+        (static_cast<uint32_t>(code) << 16U) | (static_cast<uint16_t>(fraction) << (16U - DAC_DITHER_BITS));
+    uint32_t position_ = position[channel];
+
+    if (step == 0U)
+        position_ = target;
+    else if (position_ != target) {
+        uint32_t distance = target > position_ ? target - position_ : position_ - target;
+
+        // distance * step >> 16 using two 16x16 bit multiplications. Exponential one snaps to target within 1/2 DAC
+        // code (output is already the same)
+        uint32_t delta = step;
+        if (exponential) {
+            uint16_t coefficient = step;
+            delta = static_cast<uint32_t>(static_cast<uint16_t>(distance >> 16U)) * coefficient +
+                    ((static_cast<uint32_t>(static_cast<uint16_t>(distance)) * coefficient) >> 16U);
+            if (distance <= 0x8000UL)
+                delta = distance;
+        }
+
+        if (delta == 0U || delta >= distance)
+            position_ = target;
+        else
+            position_ = target > position_ ? position_ + delta : position_ - delta;
+    }
+
+    position[channel] = position_;
+
+    // Dithered output keeps fractional part, otherwise it's rounded
+#ifdef DAC_DITHER
+    code = position_ >> 16U;
+    fraction = position_ >> (16U - DAC_DITHER_BITS);
+#else
+    code = (position_ + 0x8000UL) >> 16U;
+    fraction = 0U;
+#endif
+}
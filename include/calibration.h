@@ -75,10 +75,15 @@
 #define CALIB_VCO_MAX_SCALE .95f
 
 // EEPROM addresses
-#define EEPROM_ADDR_GAIN_1   0
-#define EEPROM_ADDR_GAIN_2   1
-#define EEPROM_ADDR_MATRIX_1 2
-#define EEPROM_ADDR_MATRIX_2 (EEPROM_ADDR_MATRIX_1 + sizeof(calibMatrix))
+#define EEPROM_ADDR_GAIN_1     0
+#define EEPROM_ADDR_GAIN_2     1
+#define EEPROM_ADDR_MATRIX_1   2
+#define EEPROM_ADDR_MATRIX_2   (EEPROM_ADDR_MATRIX_1 + sizeof(calibMatrix))
+#define EEPROM_ADDR_UNIT_INDEX (EEPROM_ADDR_MATRIX_2 + sizeof(calibMatrix))
+#define EEPROM_ADDR_UNIT_COUNT (EEPROM_ADDR_UNIT_INDEX + 1)
+
+// Size of calibration backup image in bytes (raw gain bytes + both matrices, see `Calibration::backup_read()`)
+#define CALIB_BACKUP_SIZE (2U + 2U * sizeof(calibMatrix))
 
 // How many vco note readings must be the same to consider this data point in calibration
 #define VCO_LAST_CENTS_STAB 5U
@@ -114,8 +119,11 @@ class Calibration {
   public:
     void init_check(void);
     void loop(void);
-    float note_to_mv_cal(uint8_t channel, uint16_t cents);
-    boolean active;
+    uint16_t note_to_mv_cal(uint8_t channel, uint16_t pitch);
+    uint8_t backup_read(uint16_t index);
+    void backup_write(uint16_t index, uint8_t value);
+    void backup_commit(boolean valid);
+    boolean active, backup_active;
     enum CalibStage stage;
     enum CalibVcoStage stage_vco;
 
@@ -134,6 +142,7 @@ class Calibration {
     volatile float frequency_raw;
     float frequency, target_frequency;
     struct calibMatrix calib_matrix_1, calib_matrix_2;
+    uint8_t gain_1_raw, gain_2_raw;
     uint64_t vco_calib_timer;
     uint16_t mv_current, vco_cents_last, vco_cents_buffer[VCO_LAST_CENTS_STAB], vco_note_closest_mv;
     uint8_t vco_cents_buffer_counter;
@@ -142,6 +151,7 @@ class Calibration {
     void vco(void);
     void tuner(void);
     void read_matrices(void), write_matrices(void);
+    uint8_t *backup_byte(uint16_t index);
     void btn(void);
     void btn_short_press(void), btn_long_press(void);
     void handle_interrupt(void);
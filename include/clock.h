@@ -30,6 +30,8 @@
 
 #include <Arduino.h>
 
+#include "uart.h"
+
 // Duration of clock pulse (in milliseconds)
 #define CLOCK_HIGH_DURATION 10U
 
@@ -37,31 +39,92 @@
 // #define CLOCK_INVERTED
 
 // Switch clock source to external if no MIDI clock present in this time (milliseconds)
-#define MIDI_CLOCK_TIMEOUT 2000
+#define MIDI_CLOCK_TIMEOUT 2000UL
+
+// Comment to disable MIDI clock PLL. When enabled and locked, clock output and `clock_event` follow PLL's smoothed
+// phase instead of raw (jittery) timing clock bytes. Raw ticks are used until PLL locks
+#define CLOCK_PLL
+
+// PLL tracking bandwidth (default value of `pll_bandwidth`). Phase correction gain is 1 / 2^N and frequency correction
+// gain is 1 / 2^(2N+1) per tick. Larger value - smoother output but slower response to tempo changes
+#define CLOCK_PLL_BANDWIDTH 3U
+
+// PLL is considered locked after this number of consecutive ticks with phase error less than 1/8 of tick period.
+// Lock is lost as soon as phase error exceeds 1/4 of tick period
+#define CLOCK_PLL_LOCK_TICKS 24U
+
+// Clock output phase is counted from song position 0 (MIDI Start or Song position pointer) modulo this number of
+// ticks (2 whole notes @ 24 ticks per quarter note, must be divisible by every divider's pulse period)
+#define CLOCK_TICKS_CYCLE 192U
+
+// Uncomment to enable clock jitter measurement mode. Every received timing clock byte (divider is ignored) will
+// produce clock output pulse, so edge-to-edge jitter can be measured against MIDI input with a scope / logic analyzer.
+// Also, time between receive interrupt entry and output edge will be saved into `probe_latency_min` and
+// `probe_latency_max` (in timebase ticks, see timebase.h)
+// #define CLOCK_JITTER_PROBE
 
 enum class ClockSource : uint8_t { NONE, MIDI, EXT };
+enum class PllEdge : uint8_t { NONE, PENDING, FIRED };
 
 class Clock {
   public:
     void init(void);
     void set_source(enum ClockSource source);
-    void midi_tick(void);
+    void midi_tick(uint32_t time);
+    void midi_transport(uint8_t data);
+    void midi_song_position(uint8_t data);
     void loop(void);
-    enum ClockSource source;
+    volatile enum ClockSource source;
     uint8_t divider;
-    boolean clock_event;
+    boolean clock_event, transport_event;
+    volatile boolean running;
+#ifdef CLOCK_JITTER_PROBE
+    volatile uint16_t probe_latency_min, probe_latency_max;
+#endif
+#ifdef CLOCK_PLL
+    uint16_t get_bpm(void);
+    uint16_t get_jitter(void);
+    volatile boolean pll_locked;
+    uint8_t pll_bandwidth;
+#endif
 
   private:
     volatile uint8_t *port_out_reg;
     uint8_t pin_mask;
-    uint64_t midi_tick_time_last, on_time;
-    uint8_t ticks_counter;
+    volatile uint32_t midi_tick_time_last;
+    volatile uint64_t on_time;
+    volatile uint8_t ticks_counter;
     volatile uint8_t ticks_counter_ext;
-    volatile boolean clock_event_ext;
+    volatile boolean clock_event_ext, clock_event_midi, transport_event_midi;
+    uint8_t song_position_index, song_position_lsb;
 
     void write_output(boolean state);
+    void pulse(void);
+    void seek(uint8_t ticks);
     void handle_interrupt(void);
     static void isr(void);
+#ifdef MIDI_MERGE
+    volatile uint32_t merge_time, merge_period, merge_next, merge_interval;
+    volatile uint8_t merge_remaining;
+    volatile boolean merge_reset, merge_pending;
+
+    void merge_edge(void);
+    void merge_schedule(void);
+    void handle_merge_alarm(void);
+    static void merge_isr(void);
+#endif
+#ifdef CLOCK_PLL
+    volatile uint32_t pll_period, pll_next, pll_time_last, pll_jitter;
+    volatile uint8_t pll_lock_counter;
+    volatile boolean pll_reset;
+    volatile enum PllEdge pll_edge;
+
+    void pll_restart(void);
+    void pll_update(uint32_t time);
+    void pll_schedule(void);
+    void handle_pll_alarm(void);
+    static void pll_isr(void);
+#endif
 };
 
 extern Clock clock;
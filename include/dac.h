@@ -30,9 +30,46 @@
 
 #include <Arduino.h>
 
+#include "glide.h"
+#include "mod.h"
+#include "vcc.h"
+
 // 12 bit
 #define DAC_MAX 4095U
 
+// Pass to `set_mv_q2()` to keep current target
+#define DAC_KEEP UINT16_MAX
+
+// DAC code = (target in Q14.2 mV * scale) >> DAC_SCALE_SHIFT. Scale is (filtered VCC ADC value * gain factor) >>
+// DAC_VCC_SHIFT, where gain factor is calculated only when gain calibration changes (see tools/model_compensation.py)
+#define DAC_SCALE_SHIFT 16U
+#define DAC_GAIN_SHIFT  12U
+#define DAC_VCC_SHIFT   (DAC_GAIN_SHIFT + VCC_FRACTION_BITS)
+
+// Uncomment to latch DAC values from Timer2 compare interrupt at fixed DAC_ENGINE_RATE_HZ instead of right in
+// `write()`. `write()` only hands new values to it through double-buffered frame, so output timing doesn't depend on
+// main loop period
+// #define DAC_ENGINE
+
+// Uncomment to dither DAC codes in DAC_ENGINE interrupt (first-order sigma-delta). Fractional part of DAC code
+// (DAC_DITHER_BITS) is kept instead of being truncated, and adjacent codes alternate so that their average (after VCO's
+// CV input filter) is the exact target. Use higher DAC_ENGINE_RATE_HZ with it (see tools/model_dither.py)
+// #define DAC_DITHER
+
+// Fractional bits of dithered DAC code. Fixed (fractions and sigma-delta error are stored as uint8_t)
+#define DAC_DITHER_BITS 8U
+
+// Fixed DAC update rate in Hz (Timer2 @ F_CPU / 64, must be within 977-DAC_ENGINE_RATE_HZ_MAX @ 16MHz)
+#define DAC_ENGINE_RATE_HZ 2000UL
+
+// Interrupt budget: worst case interrupt (glide + modulation + dithering, ~520 cycles with entry / exit, estimated)
+// already takes about half of the tick period at F_CPU / 1000 (1000 cycles @ 16kHz). Faster rates starve MIDI and main
+// loop
+#define DAC_ENGINE_RATE_HZ_MAX (F_CPU / 1000UL)
+
+// Timer2 compare value for DAC_ENGINE_RATE_HZ
+#define DAC_ENGINE_OCR (F_CPU / 64UL / DAC_ENGINE_RATE_HZ - 1UL)
+
 // Base (rough) DAC amplifier gains (user can calibrate +/- 0.127). Depends on R13-R16 (see schematic).
 // Change these values if you have different resistors / out of range during calibration.
 // Example: if R13 = 7K5 and R14 = 10K, then GAIN_1_BASE = 1 + (7.5 / 10) = 1.75.
@@ -40,20 +77,54 @@
 const float GAIN_1_BASE PROGMEM = 1.824f;
 const float GAIN_2_BASE PROGMEM = 1.824f;
 
+// Pair of DAC codes handed to DAC_ENGINE (with glide steps, see "include/glide.h")
+struct dacFrame {
+    uint16_t value_1, value_2;
+#ifdef DAC_DITHER
+    uint8_t fraction_1, fraction_2;
+#endif
+#ifdef GLIDE
+    uint32_t glide_step_1, glide_step_2;
+    boolean glide_exponential;
+#endif
+};
+
 class DAC {
   public:
     void init(void);
     void set(float target_1, float target_2);
+    void set_mv_q2(uint16_t target_1, uint16_t target_2);
     void write(void);
+    void write_frame(const struct dacFrame &frame_);
     void calculate_compensation(void);
+    void get_frame(struct dacFrame &frame_);
     float get_current_maximum(uint8_t dac);
+#ifdef DAC_ENGINE
+    void handle_tick(void);
+#endif
 
   private:
     volatile uint8_t *dac_1_port_out_reg, *dac_2_port_out_reg, *dac_3_port_out_reg;
     uint8_t dac_1_mask, dac_2_mask, dac_3_mask;
-    uint16_t dac_1_value, dac_2_value;
-    float vcc, dac_1_target, dac_2_target;
-    uint16_t vcc_raw;
+    struct dacFrame frame;
+#ifdef DAC_DITHER
+    uint8_t dither_error_1, dither_error_2;
+#endif
+    uint8_t latched_1, latched_2, latched_3;
+    boolean latched;
+#ifdef DAC_ENGINE
+    volatile struct dacFrame frames[2];
+    volatile uint8_t frame_front;
+    uint32_t isr_ticks;
+    uint16_t isr_count;
+#endif
+    uint16_t dac_1_target, dac_2_target;
+    uint16_t dac_1_scale, dac_2_scale;
+    uint32_t gain_1_factor, gain_2_factor;
+    float gain_1_offset_last, gain_2_offset_last;
+    uint16_t vcc_filtered;
+
+    void output(uint16_t value_1, uint16_t value_2);
 };
 
 extern DAC dac;
@@ -45,13 +45,19 @@ class GateTrig {
     void init(void);
     void loop(void);
     void set_1(boolean state, boolean from_self = false), set_2(boolean state, boolean from_self = false);
+    uint8_t snapshot(void);
+    void play(uint8_t snapshot);
+    void release(void);
     boolean merged;
     boolean gate_1_state, gate_2_state;
+    volatile boolean held;
 
   private:
     volatile uint8_t *gate_1_out_reg, *gate_2_out_reg, *trig_1_out_reg, *trig_2_out_reg;
     uint8_t gate_1_pin_mask, gate_2_pin_mask, trig_1_pin_mask, trig_2_pin_mask;
     uint64_t trig_1_timer, trig_2_timer;
+    uint8_t trigs_held;
+    volatile uint8_t trigs_released;
 
     void gate_1_write(boolean state), gate_2_write(boolean state);
     void trig_1_write(boolean state), trig_2_write(boolean state);
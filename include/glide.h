@@ -0,0 +1,80 @@
+/**
+ * @file glide.h
+ * @author Fern Lane
+ * @brief Digital glide (portamento) of DAC codes in DAC_ENGINE interrupt
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef GLIDE_H__
+#define GLIDE_H__
+
+#include <Arduino.h>
+
+// Uncomment to slew DAC codes towards new targets (portamento) at DAC_ENGINE_RATE_HZ. Glide time is set by CC5
+// (portamento time) and CC65 (portamento on / off) of CV channel's MIDI channel (any channel in omni mode).
+// NOTE: Requires DAC_ENGINE (see "include/dac.h")
+// #define GLIDE
+
+// Default glide mode and curve (see GlideMode and GlideCurve)
+#define GLIDE_MODE  GlideMode::CONSTANT_TIME
+#define GLIDE_CURVE GlideCurve::LINEAR
+
+// Glide time at CC5 = 127 in ms (time = GLIDE_TIME_MAX_MS * CC5^2 / 127^2, so lower values are finer)
+#define GLIDE_TIME_MAX_MS 5000UL
+
+// Exponential glide time in time constants (4 -> glide time is time to cover ~98% of interval)
+#define GLIDE_EXP_TIME_CONSTANTS 4.f
+
+// Glide is ON at startup (CC65 < 64 turns it OFF). Time is 0 until CC5 is received
+#define GLIDE_ENABLED_DEFAULT true
+
+// CONSTANT_TIME - every glide takes glide time, CONSTANT_RATE - glide time is per 1V (octave) of interval
+enum class GlideMode : uint8_t { CONSTANT_TIME, CONSTANT_RATE };
+
+// LINEAR - constant speed, EXPONENTIAL - slows down towards target (like analog RC portamento)
+enum class GlideCurve : uint8_t { LINEAR, EXPONENTIAL };
+
+class Glide {
+  public:
+    void init(void);
+    void set_time(uint8_t channel, uint8_t value);
+    void set_enabled(uint8_t channel, boolean enabled_);
+    void set_mode(enum GlideMode mode_, enum GlideCurve curve_);
+    uint32_t update(uint8_t channel, uint16_t target, uint16_t code, uint16_t scale);
+    void tick(uint8_t channel, uint16_t &code, uint8_t &fraction, uint32_t step, boolean exponential);
+    enum GlideMode mode;
+    enum GlideCurve curve;
+
+  private:
+    uint16_t time_ms[2];
+    boolean enabled[2], changed[2];
+    uint16_t target_last[2];
+    uint32_t step[2];
+    volatile uint32_t position[2];
+
+    uint32_t calculate_step(uint8_t channel, uint16_t code, uint16_t scale);
+};
+
+extern Glide glide;
+
+#endif
@@ -66,7 +66,8 @@ class LEDs {
   public:
     void init(void);
     void loop(void);
-    int16_t cents_1, cents_2, pitch_bend;
+    // Played pitch (including pitch bend) in cents
+    int16_t cents_1, cents_2;
 
   private:
     Adafruit_NeoPixel leds;
@@ -78,7 +79,6 @@ class LEDs {
     int16_t tuner_deviation_cent_last;
     uint8_t vco_calib_color_last;
     int16_t cents_1_last, cents_2_last;
-    int16_t pitch_bend_last;
     boolean gate_1_last, gate_2_last;
     uint32_t color_norm_1_last, color_norm_2_last;
 
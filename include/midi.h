@@ -2,7 +2,6 @@
  * @file midi.h
  * @author Fern Lane
  * @brief Main MIDI handler
- * Uses <https://github.com/TheKikGen/midiXparser> library
  *
  * @copyright Copyright (c) 2022-2025 Fern Lane
  *
@@ -31,23 +30,96 @@
 
 #include <Arduino.h>
 
-#include <midiXparser.h>
-
-// Serial begin and read functions
-// NOTE: This may conflict with DEBUG_INIT in "include/calibration.h" file
-#ifndef SERIAL_DEBUG
-#define MIDI_SERIAL_INIT Serial.begin(31250UL)
-#else
-#define MIDI_SERIAL_INIT
-#endif
-#define MIDI_SERIAL_AVAILABLE Serial.available()
-#define MIDI_SERIAL_READ      Serial.read()
+// MIDI baud rate. 31250 for DIN MIDI IN. Set to 115200, 250000, 500000 or 1000000 to receive the same MIDI bytes from
+// computer over Nano's USB-serial converter with a fraction of DIN MIDI wire latency (see tools/midi_bridge.py).
+// 250000 and higher are exact @ 16MHz. Above 250000, bytes may be lost while LEDs are updated (interrupts are disabled)
+// NOTE: USART is not used for MIDI if SERIAL_DEBUG is defined in "include/calibration.h" file
+#define MIDI_SERIAL_BAUD 31250UL
 
 // Ignore notes that are lower
 #define NOTE_MIN 12U
 
+// Default note priority of each channel (see NotePriority)
+#define NOTE_PRIORITY_1 NotePriority::LAST
+#define NOTE_PRIORITY_2 NotePriority::LAST
+
+// How notes from all 16 MIDI channels are distributed between 2 CV channels (voices) in omni normal mode
+// (see VoiceMode). Set to VoiceMode::OFF to play every note on both CV channels (unison)
+#define VOICE_MODE VoiceMode::ROUND_ROBIN
+
+// Max number of stacked units (see `MIDI::set_unit()`). All units run the same voice allocation over
+// 2 * number of units voices and each one plays only it's own 2 voices (must be less than 8)
+#define VOICE_UNITS_MAX 4U
+#define VOICES_MAX      (VOICE_UNITS_MAX * 2U)
+
+// MPE manager (master) channel. It's pitch bend is applied to all voices in VoiceMode::MPE
+#define VOICE_MPE_MANAGER_CHANNEL 0U
+
+// Default pitch bend range of each MIDI channel in semitones (can be changed by RPN 0)
+#define PITCH_BEND_RANGE_DEFAULT 2U
+
+// Uncomment to ramp between successive pitch bend values (removes zipper steps of coarse controllers, but delays
+// pitch bend by up to PITCH_BEND_RAMP_STEPS x PITCH_BEND_RAMP_INTERVAL_US)
+// #define PITCH_BEND_SMOOTHING
+
+// Pitch bend ramp: number of steps and fixed interval between them (in us)
+#define PITCH_BEND_RAMP_STEPS       8
+#define PITCH_BEND_RAMP_INTERVAL_US 1000UL
+
+// Capacity of each channel's note events queue (must be power of 2)
+#define NOTE_EVENTS_QUEUE_SIZE 8U
+
+// Bitmap of enabled notes. Note N is bit (N % 8) of bytes[N / 8]
 struct notesEnabled {
-    uint64_t msb, lsb;
+    uint8_t bytes[128 / 8];
+};
+
+// Doubly-linked list of held notes in order of pressing (most recent is `top`).
+// prev / next of note N are stored at [N - NOTE_MIN]. 255 means no note
+struct noteStack {
+    uint8_t prev[128 - NOTE_MIN], next[128 - NOTE_MIN];
+    uint8_t top;
+};
+
+// Which one of the held notes is played
+enum class NotePriority : uint8_t { LAST, LOWEST, HIGHEST };
+
+// OFF - 1st MIDI channel -> 1st voice, 2nd -> 2nd (or all channels -> both voices in omni mode),
+// ROUND_ROBIN - alternate voices, steal next one if both are busy,
+// OLDEST - use free voice, steal the one with the oldest note if both are busy,
+// MPE - same as OLDEST but each channel owns one note (new note on the same channel replaces it)
+enum class VoiceMode : uint8_t { OFF, ROUND_ROBIN, OLDEST, MPE };
+
+// Allocated note of one voice (of all stacked units). Each voice is either in busy (in order of note ON) or free
+// (in order of release) list. Voices that play the same note (on different channels) are linked by same_note
+struct voiceState {
+    uint8_t channel, note;
+    uint8_t prev, next, same_note;
+};
+
+// Doubly-linked list of voices
+struct voiceList {
+    uint8_t head, tail;
+};
+
+// Applied pitch bend of one voice (in Q8.8 semitones) and it's ramp (see PITCH_BEND_SMOOTHING)
+struct voicePitchBend {
+    int16_t current, target, step;
+};
+
+// Note ON / OFF event with arrival time of it's last byte (see timebase.h) and channel's notes right after it (so
+// events are handled against their own state even if more of them were received in one loop)
+struct noteEvent {
+    uint8_t note;
+    boolean on;
+    uint8_t priority, lowest, highest;
+    uint32_t time;
+};
+
+// Fixed-capacity FIFO of note events
+struct noteEventsQueue {
+    struct noteEvent events[NOTE_EVENTS_QUEUE_SIZE];
+    uint8_t head, tail;
 };
 
 class MIDI {
@@ -58,16 +130,57 @@ class MIDI {
     void panic(uint8_t channel);
     boolean is_note_enabled(uint8_t channel, uint8_t note);
     uint8_t get_next_note(uint8_t channel, uint8_t note_last, boolean up, boolean wrap = true);
+    uint8_t get_lowest_note(uint8_t channel), get_highest_note(uint8_t channel);
+    uint8_t get_last_note(uint8_t channel);
+    uint8_t get_priority_note(uint8_t channel);
+    void set_voice_mode(enum VoiceMode mode);
+    void set_split(boolean state);
+    boolean set_unit(uint8_t index, uint8_t count);
+    uint8_t update_pitch_bends(void);
+    int16_t get_voice_pitch_bend(uint8_t voice);
     boolean get_channel_gate(uint8_t channel);
-    boolean omni, note_1_event_on, note_2_event_on, note_1_event_off, note_2_event_off, pitch_bend_event;
+    boolean pop_event(uint8_t channel, struct noteEvent &event);
+    void clear_events(uint8_t channel);
+    enum NotePriority priority_1, priority_2;
+    boolean omni, pitch_bend_event;
     boolean panic_1_event, panic_2_event;
-    uint8_t note_1, note_2, note_last, notes_pressed_n_1, notes_pressed_n_2;
-    int16_t pitch_bend;
+    uint8_t notes_pressed_n_1, notes_pressed_n_2;
 
   private:
-    midiXparser voice_parser, clock_parser;
-    uint64_t clock_tick_last_time;
+    uint8_t parser_status, parser_info, parser_index, parser_data[2];
+    boolean parser_sysex;
     struct notesEnabled notes_enabled_1, notes_enabled_2;
+    struct noteStack notes_stack_1, notes_stack_2;
+    enum VoiceMode voice_mode;
+    boolean split;
+    struct voiceState voices[VOICES_MAX];
+    struct voiceList voices_busy, voices_free;
+    uint8_t voices_n, voice_base, voice_next;
+    uint8_t note_voices[(128 - NOTE_MIN + 1) / 2], channel_voices[16 / 2];
+    int16_t channel_pitch_bend[16];
+    uint16_t channel_pitch_bend_range[16];
+    uint8_t pitch_bend_channel;
+    uint16_t rpn_msb_zero, rpn_lsb_zero;
+    struct voicePitchBend voice_pitch_bends[2];
+#ifdef PITCH_BEND_SMOOTHING
+    uint32_t pitch_bend_ramp_time;
+#endif
+    struct noteEventsQueue events_1, events_2;
+
+    void parse(uint8_t data, uint32_t time);
+    void dispatch(uint32_t time);
+    void handle_note(uint8_t channel, uint8_t note, boolean on, uint32_t time);
+    void handle_control_change(uint8_t channel, uint8_t control, uint8_t value);
+    void allocate_note(uint8_t channel, uint8_t note, boolean on, uint32_t time);
+    void release_voice(uint8_t voice, uint32_t time);
+    void reset_voices(void);
+    uint8_t find_voice(uint8_t channel, uint8_t note);
+    void voice_list_remove(struct voiceList *list, uint8_t voice);
+    void voice_list_append(struct voiceList *list, uint8_t voice);
+    int16_t calculate_voice_pitch_bend(uint8_t voice);
+    void stack_push(struct noteStack *stack, uint8_t note), stack_remove(struct noteStack *stack, uint8_t note);
+    void push_event(uint8_t channel, uint8_t note, boolean on, uint32_t time);
+    void count_parse_error(void);
 };
 
 extern MIDI midi;
@@ -0,0 +1,123 @@
+/**
+ * @file mod.h
+ * @author Fern Lane
+ * @brief Fixed-point modulation engine (vibrato LFO and ADSR envelope) in DAC_ENGINE interrupt
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOD_H__
+#define MOD_H__
+
+#include <Arduino.h>
+
+// Uncomment to add vibrato LFO to pitch CVs at DAC_ENGINE_RATE_HZ. Depth is set by CC1 (modulation wheel) of CV
+// channel's MIDI channel (any channel in omni mode), rate by CC76 (vibrato rate) of any channel.
+// NOTE: Requires DAC_ENGINE (see "include/dac.h")
+// #define MOD
+
+// Uncomment to replace 2nd channel's pitch CV with ADSR envelope gated by 1st channel's gate (and retriggered by
+// 1st channel's trigger). Requires MOD
+// #define MOD_ADSR
+
+// Default LFO shape (see LfoShape)
+#define MOD_LFO_SHAPE LfoShape::SINE
+
+// LFO depth at CC1 = 127 (in cents, must be 200 or less)
+#define MOD_LFO_DEPTH_MAX_CENTS 50UL
+
+// LFO rate at CC76 = 0 and 127 (in 0.01Hz). Default is in the middle
+#define MOD_LFO_RATE_MIN 50UL
+#define MOD_LFO_RATE_MAX 1500UL
+
+// ADSR envelope level at full scale (in mV)
+#define MOD_ADSR_LEVEL_MV 5000UL
+
+// Attack, decay and release time at CC = 127 in ms (time = MOD_ADSR_TIME_MAX_MS * CC^2 / 127^2). Decay and release
+// are exponential (time is 4 time constants)
+#define MOD_ADSR_TIME_MAX_MS 10000UL
+
+// Envelope controllers (of 1st channel's MIDI channel). There is no standard sustain level CC
+#define MOD_ADSR_CC_ATTACK  73U
+#define MOD_ADSR_CC_DECAY   75U
+#define MOD_ADSR_CC_SUSTAIN 79U
+#define MOD_ADSR_CC_RELEASE 72U
+
+// Default envelope controllers values
+#define MOD_ADSR_ATTACK_DEFAULT  10U
+#define MOD_ADSR_DECAY_DEFAULT   40U
+#define MOD_ADSR_SUSTAIN_DEFAULT 96U
+#define MOD_ADSR_RELEASE_DEFAULT 40U
+
+// Envelope level of 1.0 (Q8.24)
+#define MOD_ADSR_LEVEL_ONE (1UL << 24U)
+
+enum class LfoShape : uint8_t { SINE, TRIANGLE };
+
+enum class AdsrStage : uint8_t { IDLE, ATTACK, DECAY, SUSTAIN, RELEASE };
+
+// Parameters handed to DAC_ENGINE interrupt (double-buffered, see `Mod::update()`)
+struct modParams {
+    uint16_t lfo_increment;           // Q0.16 LFO cycles per sample
+    int16_t lfo_depth_1, lfo_depth_2; // LFO amplitude in Q8.8 DAC codes
+    boolean lfo_triangle;             // Triangle instead of sine
+    uint32_t attack_step;             // Envelope level per sample (Q8.24)
+    uint16_t decay_coefficient;       // Q0.16 fraction of remaining distance per sample
+    uint16_t release_coefficient;     // Q0.16 fraction of remaining distance per sample
+    uint32_t sustain;                 // Sustain level (Q8.24)
+    uint16_t level_code;              // DAC code of envelope level 1.0
+};
+
+class Mod {
+  public:
+    void init(void);
+    void set_depth(uint8_t channel, uint8_t value);
+    void set_rate(uint8_t value);
+    void set_envelope(uint8_t control, uint8_t value);
+    void update(uint16_t scale_1, uint16_t scale_2);
+    void tick(uint16_t &value_1, uint16_t &value_2);
+    enum LfoShape lfo_shape;
+
+  private:
+    uint8_t depth_1, depth_2, rate, attack, decay, sustain, release;
+    boolean changed;
+    uint16_t scale_1_last, scale_2_last;
+    volatile struct modParams params[2];
+    volatile uint8_t params_front;
+
+    // Interrupt state
+    uint16_t lfo_phase;
+#ifdef MOD_ADSR
+    volatile uint8_t *gate_out_reg, *trig_out_reg;
+    uint8_t gate_mask, trig_mask, gate_invert, trig_invert;
+    uint8_t gate_last, trig_last;
+    enum AdsrStage stage;
+    uint32_t level;
+#endif
+
+    static uint32_t time_to_samples(uint8_t value);
+    static uint16_t samples_to_coefficient(uint32_t samples);
+};
+
+extern Mod mod;
+
+#endif
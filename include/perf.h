@@ -0,0 +1,99 @@
+/**
+ * @file perf.h
+ * @author Fern Lane
+ * @brief Runtime performance counters (readable over SysEx, see docs/SYSEX.md)
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PERF_H__
+#define PERF_H__
+
+#include <Arduino.h>
+
+// Version of `perfCounters` layout (first byte of SysEx reply). Bit 7 is set if probes are appended (see PERF_PROBES)
+#define PERF_VERSION 4U
+
+// Uncomment to measure duration of hot code sections in CPU cycles (see PerfProbe) and append max and average of each
+// one to performance counters. Debug only: costs 14 bytes of RAM per probe and ~10 cycles per measurement
+// #define PERF_PROBES
+
+#ifdef PERF_PROBES
+// Set bit 7 of layout version
+#define PERF_VERSION_PROBES 0x80U
+
+// Measured code sections:
+// PARSE_BYTE - `MIDI::parse()` of one received byte (including dispatch of completed message),
+// NOTE_SCAN - `MIDI::get_next_note()` (arpeggiator step),
+// CV_UPDATE - applying pitch bends and converting CVs in `loop()`,
+// DAC_OUTPUT - `DAC::output()` that shifts and latches all 3 registers (full two-channel update)
+enum class PerfProbe : uint8_t { PARSE_BYTE, NOTE_SCAN, CV_UPDATE, DAC_OUTPUT };
+
+// Number of probes
+#define PERF_PROBES_N 4U
+#endif
+
+// Runtime counters. 16-bit counters saturate, 32-bit ones wrap around.
+// NOTE: Layout is sent as is (little-endian, without padding) over SysEx. Increase PERF_VERSION after changing it
+struct __attribute__((packed)) perfCounters {
+    uint8_t version;
+    uint32_t rx_bytes;       // MIDI bytes received
+    uint16_t rx_overruns;    // USART data overruns (DOR flag, byte was lost before receive interrupt)
+    uint16_t rx_dropped;     // Bytes dropped because receive buffer was full (main loop is too slow)
+    uint16_t parse_errors;   // Data bytes without status, incomplete messages and interrupted SysEx
+    uint16_t events_dropped; // Note events dropped because events queue was full
+    uint16_t loop_max;       // Max period of `loop()` in microseconds
+    uint16_t loop_avg;       // Average period of `loop()` in microseconds
+    uint32_t clock_in;       // MIDI timing clock bytes received
+    uint32_t clock_out;      // Clock output pulses (in MIDI clock mode)
+    uint16_t late_events;    // Messages played after their playout time (see PLAYOUT in "include/playout.h")
+    uint16_t late_max;       // Max lateness of played messages in microseconds
+    uint32_t dac_latched;    // DAC shift registers written and latched
+    uint32_t dac_skipped;    // DAC shift register writes skipped because their contents didn't change
+    uint16_t dac_isr_max;    // Max DAC_ENGINE interrupt duration in CPU cycles (see "include/dac.h")
+    uint16_t dac_isr_load;   // DAC_ENGINE interrupt CPU load over the last second in 0.01%
+#ifdef PERF_PROBES
+    uint16_t probe_max[PERF_PROBES_N]; // Max duration of each probe in CPU cycles (see PerfProbe)
+    uint16_t probe_avg[PERF_PROBES_N]; // Average duration of each probe in CPU cycles (calculated by `read()`)
+#endif
+};
+
+class Perf {
+  public:
+    void loop(void);
+    void read(struct perfCounters &snapshot, boolean reset = false);
+#ifdef PERF_PROBES
+    void probe(enum PerfProbe probe, uint16_t ticks);
+#endif
+    volatile struct perfCounters counters;
+
+  private:
+    uint32_t loop_time, loop_avg_sum;
+#ifdef PERF_PROBES
+    uint32_t probe_ticks[PERF_PROBES_N];
+    uint16_t probe_count[PERF_PROBES_N];
+#endif
+};
+
+extern Perf perf;
+
+#endif
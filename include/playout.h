@@ -0,0 +1,79 @@
+/**
+ * @file playout.h
+ * @author Fern Lane
+ * @brief Fixed-latency playout of received MIDI messages (jitter buffer)
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PLAYOUT_H__
+#define PLAYOUT_H__
+
+#include <Arduino.h>
+
+#include "dac.h"
+
+// Uncomment to play every received message out to the DAC and gates exactly PLAYOUT_DELAY_US after it's arrival
+// (instead of as soon as main loop gets to it). Latency becomes higher, but constant
+// #define PLAYOUT
+
+// Constant latency from arrival of message's last byte to DAC / gates (in us). Bytes wait for their playout time in
+// UART receive buffer, so it must hold PLAYOUT_DELAY_US of MIDI data (32 bytes is ~10ms @ 31250 Bps)
+#define PLAYOUT_DELAY_US 3000UL
+
+// How early message is parsed before it's playout time (in us). Must be longer than the slowest main loop period
+// (see `loop_max` performance counter in docs/SYSEX.md). Otherwise, message is played late and counted in
+// `late_events`
+#define PLAYOUT_LEAD_US 1500UL
+
+// Max number of messages which outputs wait for their playout time at once (power of 2, one slot is always free).
+// Each one takes 9-20 bytes of RAM (see playoutSnapshot). Parsing stops while queue is full
+#define PLAYOUT_QUEUE_SIZE 8U
+#define PLAYOUT_QUEUE_MASK (PLAYOUT_QUEUE_SIZE - 1U)
+
+// Outputs of one message held until it's playout time
+struct playoutSnapshot {
+    uint32_t deadline;     // Playout time (see timebase.h)
+    struct dacFrame frame; // Calculated DAC values (see `DAC::get_frame()`)
+    uint8_t gates;         // Gates and triggers (see `GateTrig::snapshot()`)
+};
+
+class Playout {
+  public:
+    boolean due(uint32_t time);
+    boolean pending(void);
+    void hold(uint32_t time);
+    void loop(void);
+
+  private:
+    volatile boolean held;
+    uint32_t deadline;
+    struct playoutSnapshot queue[PLAYOUT_QUEUE_SIZE];
+    volatile uint8_t queue_head, queue_tail;
+
+    void handle_alarm(void);
+    static void isr(void);
+};
+
+extern Playout playout;
+
+#endif
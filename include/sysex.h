@@ -0,0 +1,90 @@
+/**
+ * @file sysex.h
+ * @author Fern Lane
+ * @brief SysEx commands (calibration backup and restore)
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SYSEX_H__
+#define SYSEX_H__
+
+#include <Arduino.h>
+
+#include "perf.h"
+
+// Manufacturer ID (0x7D - non-commercial / educational use) and device ID of CMCEC (see docs/SYSEX.md)
+#define SYSEX_MANUFACTURER_ID 0x7DU
+#define SYSEX_DEVICE_ID       0x43U
+
+// Commands
+#define SYSEX_CMD_CALIB_REQUEST 0x01U
+#define SYSEX_CMD_CALIB_DATA    0x02U
+#define SYSEX_CMD_SET_UNIT      0x03U
+#define SYSEX_CMD_PERF_REQUEST  0x04U
+#define SYSEX_CMD_PERF_DATA     0x05U
+#define SYSEX_CMD_ACK           0x7FU
+
+// ACK statuses
+#define SYSEX_ACK_OK             0x00U
+#define SYSEX_ACK_ERROR_LENGTH   0x01U
+#define SYSEX_ACK_ERROR_CHECKSUM 0x02U
+#define SYSEX_ACK_ERROR_ABORTED  0x03U
+#define SYSEX_ACK_ERROR_VALUE    0x04U
+
+// Data is sent as groups of up to 7 bytes, each group starts with a byte containing their MSBs (bit 0 - 1st byte)
+#define SYSEX_PACK_GROUP 7U
+
+enum class SysExRxState : uint8_t { IDLE, MANUFACTURER, DEVICE, COMMAND, PAYLOAD };
+enum class SysExTxState : uint8_t { IDLE, HEADER, DATA, CHECKSUM, END };
+
+class SysEx {
+  public:
+    void start(void);
+    void data(uint8_t data);
+    void end(void);
+    void abort(void);
+    void loop(void);
+
+  private:
+    enum SysExRxState rx_state;
+    uint8_t rx_command, rx_group_pos, rx_group_msbs, rx_checksum_n;
+    uint16_t rx_index, rx_checksum, rx_checksum_received;
+    uint8_t rx_args[2];
+    enum SysExTxState tx_state;
+    uint8_t tx_pos, tx_command;
+    uint16_t tx_index, tx_size, tx_checksum;
+    struct perfCounters tx_perf;
+    uint8_t ack_command, ack_status;
+    boolean ack_pending;
+
+    void receive_calib(uint8_t data);
+    void finish_calib(boolean aborted);
+    void start_transmit(uint8_t command, uint16_t size);
+    uint8_t transmit_data(void);
+    uint8_t read_data(uint16_t index);
+    void finish_unit(void);
+};
+
+extern SysEx sysex;
+
+#endif
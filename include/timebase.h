@@ -0,0 +1,65 @@
+/**
+ * @file timebase.h
+ * @author Fern Lane
+ * @brief Free-running Timer1 -based high resolution timestamps
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TIMEBASE_H__
+#define TIMEBASE_H__
+
+#include <Arduino.h>
+
+// Timer1 runs at F_CPU / 8 (0.5us per tick @ 16MHz). 32-bit timestamps overflow every ~35 minutes @ 16MHz,
+// so always compare them using unsigned difference
+#define TIMEBASE_TICKS_PER_US (F_CPU / 8000000UL)
+
+// Alarms closer than this (in ticks) are fired immediately instead of arming Timer1 compare
+#define TIMEBASE_ALARM_MIN_TICKS 16L
+
+// Independent alarms (one per Timer1 compare unit): clock output (compare B) and playout (compare A)
+#define TIMEBASE_ALARM_CLOCK   0U
+#define TIMEBASE_ALARM_PLAYOUT 1U
+#define TIMEBASE_ALARMS        2U
+
+class Timebase {
+  public:
+    void init(void);
+    uint32_t now(void);
+    void set_alarm(uint8_t alarm, uint32_t time, void (*callback)(void));
+    void cancel_alarm(uint8_t alarm);
+    void handle_overflow(void);
+    void handle_compare(uint8_t alarm);
+
+  private:
+    volatile uint16_t overflows;
+    volatile uint32_t alarm_time[TIMEBASE_ALARMS];
+    void (*volatile alarm_callback[TIMEBASE_ALARMS])(void);
+    volatile uint8_t alarms_pending;
+
+    void arm_alarm(uint8_t alarm);
+};
+
+extern Timebase timebase;
+
+#endif
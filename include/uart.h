@@ -0,0 +1,132 @@
+/**
+ * @file uart.h
+ * @author Fern Lane
+ * @brief Interrupt-driven USART with timestamped receive ring buffer (replaces HardwareSerial for MIDI)
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef UART_H__
+#define UART_H__
+
+#include <Arduino.h>
+
+#include "calibration.h"
+#include "midi.h"
+#include "playout.h"
+
+// Size of receive buffer in bytes (must be power of 2). 16 bytes is ~5ms of MIDI data @ 31250 Bps. High speed transport
+// (see MIDI_SERIAL_BAUD) delivers bursts faster than main loop reads them and PLAYOUT keeps bytes in it until their
+// playout time, so they need more space
+#if MIDI_SERIAL_BAUD > 31250UL || defined(PLAYOUT)
+#define UART_RX_BUFFER_SIZE 32U
+#else
+#define UART_RX_BUFFER_SIZE 16U
+#endif
+
+// Size of transmit buffer in bytes (must be power of 2)
+#define UART_TX_BUFFER_SIZE 16U
+
+// Uncomment to forward every received byte to TX pin right from the receive interrupt (MIDI THRU)
+// #define MIDI_THRU
+
+// Uncomment to merge locally generated messages into TX (MIDI timing clocks of external clock input edges)
+// #define MIDI_MERGE
+
+// External clock input resolution for MIDI_MERGE (pulses per quarter note, must divide 24). Every edge is sent as
+// 24 / MIDI_MERGE_EXT_PPQN timing clocks: the first one right away and the rest spread over previous edge period
+#define MIDI_MERGE_EXT_PPQN 24U
+
+// Size of MIDI THRU buffer in bytes (must be power of 2). Bytes that don't fit are dropped, so this also limits
+// forwarding delay to ~5ms (16 bytes @ 31250 Bps)
+#define UART_THRU_BUFFER_SIZE 16U
+
+// Size of real-time messages (0xF8-0xFF) buffer in bytes (must be power of 2)
+#define UART_REALTIME_BUFFER_SIZE 4U
+
+// Real-time messages bypass other messages both in THRU and merge modes
+#if defined(MIDI_THRU) || defined(MIDI_MERGE)
+#define UART_REALTIME_QUEUE
+#endif
+
+// Received byte with it's arrival time (see timebase.h)
+struct uartRxEntry {
+    uint8_t data;
+    uint32_t time;
+};
+
+// Byte to transmit with it's arrival time (lower 16 bits of timebase, used for forwarding delay measurement)
+struct uartTxEntry {
+    uint8_t data;
+    uint16_t time;
+};
+
+// Message boundaries of transmitted stream. remaining = number of data bytes left (UINT8_MAX inside SysEx)
+struct uartStream {
+    uint8_t status;
+    uint8_t remaining;
+};
+
+enum class UartTxSource : uint8_t { NONE, LOCAL, THRU };
+
+class UART {
+  public:
+    void init(uint32_t baud);
+    boolean read(uint8_t &data, uint32_t &time);
+    boolean peek(uint32_t &time);
+    boolean write(uint8_t data);
+    uint8_t tx_free(void);
+    void handle_rx(void);
+    void handle_tx(void);
+#ifdef UART_REALTIME_QUEUE
+    boolean write_realtime(uint8_t data);
+    volatile uint16_t thru_delay_max, thru_dropped;
+#endif
+
+  private:
+    volatile struct uartRxEntry rx_buffer[UART_RX_BUFFER_SIZE];
+    volatile uint8_t rx_head, rx_tail;
+    volatile uint8_t tx_buffer[UART_TX_BUFFER_SIZE];
+    volatile uint8_t tx_head, tx_tail;
+#ifdef UART_REALTIME_QUEUE
+    volatile struct uartTxEntry rt_buffer[UART_REALTIME_BUFFER_SIZE];
+    volatile uint8_t rt_head, rt_tail;
+
+    void send_entry(volatile struct uartTxEntry &entry);
+#endif
+#ifdef MIDI_THRU
+    volatile struct uartTxEntry thru_buffer[UART_THRU_BUFFER_SIZE];
+    volatile uint8_t thru_head, thru_tail;
+    struct uartStream thru_input, thru_stream, local_stream;
+    boolean thru_status_queued, thru_skip;
+    enum UartTxSource tx_source;
+    uint8_t tx_status;
+
+    void thru(uint8_t data, uint16_t time);
+    void thru_push(uint8_t data, uint16_t time);
+#endif
+    void send(uint8_t data);
+};
+
+extern UART uart;
+
+#endif
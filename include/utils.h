@@ -30,6 +30,13 @@
 
 #include <Arduino.h>
 
+// Pitch format: MIDI note number in Q8.8 fixed-point (1/256 semitone, ~0.39 cent resolution). Ex.: 60 << 8 - C4
+#define PITCH_SEMITONE 256U
+#define PITCH_MAX      (127U * PITCH_SEMITONE)
+
+// Voltage format: millivolts in Q14.2 fixed-point (1/4 mV resolution, up to 16383.75 mV)
+#define MV_Q2_ONE 4U
+
 /**
  * @brief Arduino's map() function but for float
  */
@@ -79,15 +86,27 @@ inline int16_t hz_to_cents_deviation(float target, float measured) {
 }
 
 /**
- * @brief Converts MIDI note into mV in 1V/Oct scale. Ex: 6000 (C4) = 4000mV
+ * @brief Converts pitch into mV in 1V/Oct scale. Ex: 60 << 8 (C4) = 4000mV (16000)
+ *
+ * @param pitch MIDI note number in Q8.8 (see PITCH_SEMITONE)
+ * @return uint16_t voltage in Q14.2 mV (see MV_Q2_ONE), 0 for notes below C0 (12)
  */
-inline float note_to_mv(uint16_t cents) {
-    if (cents <= 1200U)
-        return 0.0f;
+inline uint16_t pitch_to_mv_q2(uint16_t pitch) {
+    if (pitch <= 12U * PITCH_SEMITONE)
+        return 0U;
 
-    uint8_t octave = static_cast<uint8_t>(cents / 1200U);
-    float note = static_cast<float>(cents % 1200U) / 1200.0f;
-    return 1000.0f * (static_cast<float>(octave - 1U) + note);
+    // 4000 / (12 * 256) = 125 / 96
+    return static_cast<uint16_t>((static_cast<uint32_t>(pitch - 12U * PITCH_SEMITONE) * 125UL) / 96UL);
+}
+
+/**
+ * @brief Converts pitch into cents. Ex: 60 << 8 (C4) = 6000
+ *
+ * @param pitch MIDI note number in Q8.8 (see PITCH_SEMITONE)
+ * @return uint16_t MIDI note number in cents (rounded)
+ */
+inline uint16_t pitch_to_cents(uint16_t pitch) {
+    return static_cast<uint16_t>((static_cast<uint32_t>(pitch) * 100UL + PITCH_SEMITONE / 2U) / PITCH_SEMITONE);
 }
 
 /**
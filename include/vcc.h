@@ -0,0 +1,61 @@
+/**
+ * @file vcc.h
+ * @author Fern Lane
+ * @brief Interrupt-driven, oversampled and filtered VCC measurement (against internal 1.1V reference)
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VCC_H__
+#define VCC_H__
+
+#include <Arduino.h>
+
+// ADC converts internal reference on every Timer0 overflow (~976 times per second @ 16MHz) in background.
+// Sum of 2^VCC_SAMPLES_SHIFT conversions is one decimated value (64 samples -> ~15 values per second)
+#define VCC_SAMPLES_SHIFT 6U
+
+// Fractional bits of filtered value (raw ADC units in Q10.4)
+#define VCC_FRACTION_BITS 4U
+
+// Decimated values are averaged by 1st order IIR filter with 1 / 2^VCC_IIR_SHIFT coefficient (~0.26s time constant)
+#define VCC_IIR_SHIFT 2U
+
+// Filtered value changes only if average differs from it by more than this (in Q10.4 raw ADC units, 16 = 1 LSB).
+// Kept below 1 LSB, so fractional bits are not thrown away
+#define VCC_HYSTERESIS 8U
+
+class VCC {
+  public:
+    void init(void);
+    uint16_t get(void);
+    void handle_conversion(void);
+
+  private:
+    volatile uint16_t filtered;
+    uint16_t sum, average;
+    uint8_t samples;
+};
+
+extern VCC vcc;
+
+#endif
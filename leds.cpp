@@ -220,10 +220,10 @@ void LEDs::normal_loop(void) {
         boolean &gate = (i ? gate_trig.gate_2_state : gate_trig.gate_1_state);
         boolean &gate_last = (i ? gate_2_last : gate_1_last);
 
-        if (cents == cents_last && pitch_bend == pitch_bend_last && gate == gate_last)
+        if (cents == cents_last && gate == gate_last)
             continue;
 
-        uint16_t cents_ = static_cast<uint16_t>(cents + pitch_bend);
+        uint16_t cents_ = static_cast<uint16_t>(cents);
         if (cents_ > 12700U)
             cents_ = 12700U;
         uint32_t color = this->leds.gamma32(
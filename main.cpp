@@ -32,28 +32,46 @@
 #include "include/dac.h"
 #include "include/dip_switch.h"
 #include "include/gate_trig.h"
+#include "include/glide.h"
 #include "include/leds.h"
 #include "include/midi.h"
-
-// Default notes at startup in cents (6000 cents = note 60 = C4 (aka middle C))
-#define NOTE_START_1_CENTS 6000
-#define NOTE_START_2_CENTS 6000
+#include "include/mod.h"
+#include "include/perf.h"
+#include "include/playout.h"
+#include "include/sysex.h"
+#include "include/timebase.h"
+#include "include/utils.h"
+#include "include/vcc.h"
+
+// Default notes at startup (60 = C4 (aka middle C))
+#define NOTE_START_1 60U
+#define NOTE_START_2 60U
 
 // For middle point calculation in polyphonic mode (0-1, closer to 1, slower middle point will be moving)
 #define MIDPOINT_FILTER_K .65f
 
-int16_t target_cents_1, target_cents_2;
+uint16_t target_pitch_1, target_pitch_2;
+boolean channel_1_changed, channel_2_changed;
 uint8_t arp_note_1, arp_note_2, omni_note_1, omni_note_2;
 float omni_note_midpoint;
 
 // Methods declaration (see bottom of this file)
 void direct_channel_mode(uint8_t channel), split_channel_mode(void), arp_mode(uint8_t channel, boolean up);
+void split_channel_event(const struct noteEvent &event);
 void update_omni_midpoint(void);
-void write_to_channel(boolean channel_1, boolean channel_2);
+void update_channel(boolean channel_1, boolean channel_2), write_channels(void);
 
 void setup() {
+    timebase.init();
     leds.init();
+#ifdef GLIDE
+    glide.init();
+#endif
+#ifdef MOD
+    mod.init();
+#endif
     dac.init();
+    vcc.init();
     gate_trig.init();
     dip_switch.init();
     calibration.init_check();
@@ -61,13 +79,15 @@ void setup() {
         midi.init();
         clock.init();
         clock.set_source(ClockSource::EXT);
-        target_cents_1 = NOTE_START_1_CENTS;
-        target_cents_2 = NOTE_START_2_CENTS;
-        write_to_channel(true, true);
+        target_pitch_1 = NOTE_START_1 * PITCH_SEMITONE;
+        target_pitch_2 = NOTE_START_2 * PITCH_SEMITONE;
+        update_channel(true, true);
+        write_channels();
     }
 }
 
 void loop() {
+    perf.loop();
     dip_switch.read();
 
     // Calibration button handling and calibration loop
@@ -75,6 +95,7 @@ void loop() {
 
     if (!calibration.active) {
         midi.loop();
+        sysex.loop();
         clock.loop();
 
         // Prase DIP switch (see manual for more info)
@@ -87,13 +108,20 @@ void loop() {
         boolean arp_2_up = dip_switch.states & 0b00000001U;
         boolean split_left_right = !(dip_switch.states & 0b00001100U) && (dip_switch.states & 0b00000011U);
 
-        // Reset arpeggiators
-        if (!arp_1_enabled)
+        // Distribute notes from all MIDI channels between CV channels in omni normal mode
+        midi.set_voice_mode((midi.omni && !arp_1_enabled && !arp_2_enabled && !split_left_right) ? VOICE_MODE
+                                                                                                  : VoiceMode::OFF);
+
+        // Both CV channels follow 1st MIDI channel's pitch bend in split mode
+        midi.set_split(split_left_right);
+
+        // Reset arpeggiators (MIDI Start and Song position pointer restart them from the first note)
+        if (!arp_1_enabled || clock.transport_event)
             arp_note_1 = 255U;
-        if (!arp_2_enabled)
+        if (!arp_2_enabled || clock.transport_event)
             arp_note_2 = 255U;
 
-        // Button long press -> panic event
+        // Button long press -> panic event (resets voice allocation too, see `midi.panic()`)
         if (calibration.btn_event_long) {
             midi.panic(2U);
             gate_trig.set_1(false);
@@ -128,63 +156,85 @@ void loop() {
         if (split_left_right)
             split_channel_mode();
 
-        // Handle pitch bend
-        if (midi.pitch_bend_event) {
-            midi.pitch_bend_event = false;
-            write_to_channel(true, true);
-        }
+#ifdef PERF_PROBES
+        uint16_t probe_start = TCNT1;
+#endif
+
+        // Apply latest pitch bends (only voices which pitch bend changed)
+        uint8_t pitch_bends_changed = midi.update_pitch_bends();
+        if (pitch_bends_changed)
+            update_channel(pitch_bends_changed & 0x01U, pitch_bends_changed & 0x02U);
+
+        // Convert and write CVs (at most once per loop)
+        write_channels();
+#ifdef PERF_PROBES
+        perf.probe(PerfProbe::CV_UPDATE, TCNT1 - probe_start);
+#endif
     }
 
     // Write everything
     gate_trig.loop();
+#ifdef PLAYOUT
+    // Held and queued outputs are written by playout alarm. LEDs wait too, because `show()` disables interrupts and
+    // would delay it
+    if (playout.pending())
+        playout.loop();
+    else {
+        leds.loop();
+        dac.calculate_compensation();
+        dac.write();
+    }
+#else
     leds.loop();
     dac.calculate_compensation();
     dac.write();
+#endif
 
-    // Clear event only after both arpeggiator and LEDs
+    // Clear events only after both arpeggiator and LEDs
     clock.clock_event = false;
+    clock.transport_event = false;
 }
 
 /**
- * @brief Simplest mode. Just writes note from MIDI into CV and starts / stop gate and trigger
+ * @brief Simplest mode. Writes note selected by channel's note priority (see `midi.get_priority_note()`) into CV and
+ * starts / stop gate and trigger. Releasing played note falls back to still held one without retriggering (legato).
+ * Handles all pending note events of the channel in order (each against priority note right after it, so note that
+ * was pressed and released in one loop still fires gate and trigger)
  *
  * @param channel 0 or 1
  */
 void direct_channel_mode(uint8_t channel) {
-    bool &event_on = (channel ? midi.note_2_event_on : midi.note_1_event_on);
-    bool &event_off = (channel ? midi.note_2_event_off : midi.note_1_event_off);
-    if (!event_on && !event_off)
-        return;
-
-    // Write CV
-    if (event_on) {
-        (channel ? target_cents_2 : target_cents_1) = static_cast<int16_t>(channel ? midi.note_2 : midi.note_1) * 100;
-        if (channel)
-            write_to_channel(false, true);
-        else
-            write_to_channel(true, false);
-    }
+    struct noteEvent event;
+    while (midi.pop_event(channel, event)) {
+        uint8_t note = event.priority;
+
+        // All notes on channel are OFF
+        if (note > 127U) {
+            if (channel)
+                gate_trig.set_2(false);
+            else
+                gate_trig.set_1(false);
+            continue;
+        }
 
-    // All notes on channel are OFF
-    if (event_off && !midi.get_channel_gate(channel)) {
-        if (channel)
-            gate_trig.set_2(false);
-        else
-            gate_trig.set_1(false);
-    }
+        // Write CV (if played note changed or it was pressed again)
+        uint16_t &target_pitch = (channel ? target_pitch_2 : target_pitch_1);
+        if (target_pitch != note * PITCH_SEMITONE || (event.on && event.note == note)) {
+            target_pitch = note * PITCH_SEMITONE;
+            if (channel)
+                update_channel(false, true);
+            else
+                update_channel(true, false);
+        }
 
-    // Start gate / retrigger
-    else if (event_on) {
-        if (channel)
-            gate_trig.set_2(true);
-        else
-            gate_trig.set_1(true);
+        // Start gate / retrigger only if pressed note is played
+        if (event.on && event.note == note) {
+            if (channel)
+                gate_trig.set_2(true);
+            else
+                gate_trig.set_1(true);
+        }
     }
-
-    // Clear events (because we handled them)
-    event_on = false;
-    event_off = false;
-    midi.pitch_bend_event = false;
 }
 
 /**
@@ -193,27 +243,38 @@ void direct_channel_mode(uint8_t channel) {
  * be used.
  */
 void split_channel_mode(void) {
-    if (!midi.note_1_event_on && !midi.note_1_event_off)
-        return;
+    // 2nd channel's events are not used in this mode
+    midi.clear_events(1U);
 
+    struct noteEvent event;
+    while (midi.pop_event(0U, event))
+        split_channel_event(event);
+}
+
+/**
+ * @brief Handles one note event in split mode (see `split_channel_mode()`)
+ *
+ * @param event note event from 1st channel (with lowest / highest notes right after it)
+ */
+void split_channel_event(const struct noteEvent &event) {
     // Handle note OFF event
-    if (midi.note_1_event_off) {
+    if (!event.on) {
         // All notes are off
-        if (midi.notes_pressed_n_1 == 0U) {
+        if (event.lowest > 127U) {
             gate_trig.set_1(false);
             gate_trig.set_2(false);
         }
 
         // 1 Note left
-        else if (midi.notes_pressed_n_1 == 1U) {
+        else if (event.lowest == event.highest) {
             // 1st note OFF
-            if (midi.note_1 == omni_note_1) {
+            if (event.note == omni_note_1) {
                 if (!gate_trig.merged)
                     gate_trig.set_1(false);
             }
 
             // 2nd note OFF
-            else if (midi.note_1 == omni_note_2) {
+            else if (event.note == omni_note_2) {
                 if (!gate_trig.merged)
                     gate_trig.set_2(false);
             }
@@ -222,46 +283,43 @@ void split_channel_mode(void) {
         // Still multiple notes are ON -> write to DAC without re-triggering
         else {
             // 1st note OFF
-            if (midi.note_1 == omni_note_1) {
-                omni_note_1 = midi.get_next_note(0U, 0U, true, false);
-                target_cents_1 = static_cast<int16_t>(omni_note_1) * 100;
-                write_to_channel(true, false);
+            if (event.note == omni_note_1) {
+                omni_note_1 = event.lowest;
+                target_pitch_1 = omni_note_1 * PITCH_SEMITONE;
+                update_channel(true, false);
             }
 
             // 2nd note OFF
-            else if (midi.note_1 == omni_note_2) {
-                omni_note_2 = midi.get_next_note(0U, 127U, false, false);
-                target_cents_2 = static_cast<int16_t>(omni_note_2) * 100;
-                write_to_channel(false, true);
+            else if (event.note == omni_note_2) {
+                omni_note_2 = event.highest;
+                target_pitch_2 = omni_note_2 * PITCH_SEMITONE;
+                update_channel(false, true);
             }
 
             update_omni_midpoint();
         }
-
-        midi.note_1_event_off = false;
-        midi.note_2_event_off = false;
         return;
     }
 
     // Handle note ON event, more then 1 note pressed
-    if (midi.notes_pressed_n_1 > 1U) {
+    if (event.lowest != event.highest) {
         // Get left-most and right-most notes
-        uint8_t note_1 = midi.get_next_note(0U, 0U, true, false);
-        uint8_t note_2 = midi.get_next_note(0U, 127U, false, false);
+        uint8_t note_1 = event.lowest;
+        uint8_t note_2 = event.highest;
 
         // Left note pressed
-        if (midi.note_1 == note_1) {
+        if (event.note == note_1) {
             omni_note_1 = note_1;
-            target_cents_1 = static_cast<int16_t>(note_1) * 100;
-            write_to_channel(true, false);
+            target_pitch_1 = note_1 * PITCH_SEMITONE;
+            update_channel(true, false);
             gate_trig.set_1(true);
         }
 
         // Right note pressed
-        else if (midi.note_1 == note_2) {
+        else if (event.note == note_2) {
             omni_note_2 = note_2;
-            target_cents_2 = static_cast<int16_t>(note_2) * 100;
-            write_to_channel(false, true);
+            target_pitch_2 = note_2 * PITCH_SEMITONE;
+            update_channel(false, true);
             gate_trig.set_2(true);
         }
     }
@@ -270,27 +328,22 @@ void split_channel_mode(void) {
     else {
         boolean channel = false;
         if (omni_note_midpoint != 0.f)
-            channel = static_cast<float>(midi.note_1) > omni_note_midpoint;
+            channel = static_cast<float>(event.note) > omni_note_midpoint;
 
         if (channel) {
-            omni_note_2 = midi.note_1;
-            target_cents_2 = static_cast<int16_t>(omni_note_2) * 100;
-            write_to_channel(false, true);
+            omni_note_2 = event.note;
+            target_pitch_2 = omni_note_2 * PITCH_SEMITONE;
+            update_channel(false, true);
             gate_trig.set_2(true);
         } else {
-            omni_note_1 = midi.note_1;
-            target_cents_1 = static_cast<int16_t>(omni_note_1) * 100;
-            write_to_channel(true, false);
+            omni_note_1 = event.note;
+            target_pitch_1 = omni_note_1 * PITCH_SEMITONE;
+            update_channel(true, false);
             gate_trig.set_1(true);
         }
     }
 
     update_omni_midpoint();
-
-    // Clear events (because we handled them)
-    midi.note_1_event_on = false;
-    midi.note_2_event_on = false;
-    midi.pitch_bend_event = false;
 }
 
 /**
@@ -302,10 +355,7 @@ void split_channel_mode(void) {
  */
 void arp_mode(uint8_t channel, boolean up) {
     // Clear events (because we don't care in this mode)
-    midi.note_1_event_on = false;
-    midi.note_1_event_off = false;
-    midi.note_2_event_on = false;
-    midi.note_2_event_off = false;
+    midi.clear_events(channel);
 
     // Wait for clock
     if (!clock.clock_event)
@@ -329,12 +379,12 @@ void arp_mode(uint8_t channel, boolean up) {
     }
 
     // Write note and set gate ON / retrigger
-    (channel ? target_cents_2 : target_cents_1) = static_cast<int16_t>(arp_note) * 100;
+    (channel ? target_pitch_2 : target_pitch_1) = arp_note * PITCH_SEMITONE;
     if (channel) {
-        write_to_channel(false, true);
+        update_channel(false, true);
         gate_trig.set_2(true);
     } else {
-        write_to_channel(true, false);
+        update_channel(true, false);
         gate_trig.set_1(true);
     }
 }
@@ -358,24 +408,39 @@ void update_omni_midpoint(void) {
 }
 
 /**
- * @brief Writes `target_cents_1` / `target_cents_2` + `midi.pitch_bend` to the DAC and LEDs
+ * @brief Marks channels to be written by `write_channels()`
  *
  * @param channel_1 true to write to 1st channel
  * @param channel_2 true to write to 2nd channel
  */
-void write_to_channel(boolean channel_1, boolean channel_2) {
-    leds.cents_1 = target_cents_1;
-    leds.cents_2 = target_cents_2;
-    leds.pitch_bend = midi.pitch_bend;
-    if (channel_1 && channel_2) {
-        float mv_1 = calibration.note_to_mv_cal(0U, static_cast<uint16_t>(target_cents_1 + midi.pitch_bend));
-        float mv_2 = calibration.note_to_mv_cal(1U, static_cast<uint16_t>(target_cents_2 + midi.pitch_bend));
-        dac.set(mv_1, mv_2);
-    } else if (channel_1) {
-        float mv = calibration.note_to_mv_cal(0U, static_cast<uint16_t>(target_cents_1 + midi.pitch_bend));
-        dac.set(mv, NAN);
-    } else {
-        float mv = calibration.note_to_mv_cal(1U, static_cast<uint16_t>(target_cents_2 + midi.pitch_bend));
-        dac.set(NAN, mv);
+void update_channel(boolean channel_1, boolean channel_2) {
+    if (channel_1)
+        channel_1_changed = true;
+    if (channel_2)
+        channel_2_changed = true;
+}
+
+/**
+ * @brief Writes `target_pitch_1` / `target_pitch_2` + voice's pitch bend of changed channels to the DAC and LEDs
+ */
+void write_channels(void) {
+    if (!channel_1_changed && !channel_2_changed)
+        return;
+
+    uint16_t mv_1 = DAC_KEEP, mv_2 = DAC_KEEP;
+    if (channel_1_changed) {
+        int32_t pitch = static_cast<int32_t>(target_pitch_1) + midi.get_voice_pitch_bend(0U);
+        pitch = constrain(pitch, 0L, static_cast<int32_t>(PITCH_MAX));
+        leds.cents_1 = pitch_to_cents(static_cast<uint16_t>(pitch));
+        mv_1 = calibration.note_to_mv_cal(0U, static_cast<uint16_t>(pitch));
+        channel_1_changed = false;
+    }
+    if (channel_2_changed) {
+        int32_t pitch = static_cast<int32_t>(target_pitch_2) + midi.get_voice_pitch_bend(1U);
+        pitch = constrain(pitch, 0L, static_cast<int32_t>(PITCH_MAX));
+        leds.cents_2 = pitch_to_cents(static_cast<uint16_t>(pitch));
+        mv_2 = calibration.note_to_mv_cal(1U, static_cast<uint16_t>(pitch));
+        channel_2_changed = false;
     }
+    dac.set_mv_q2(mv_1, mv_2);
 }
@@ -2,7 +2,6 @@
  * @file midi.cpp
  * @author Fern Lane
  * @brief Main MIDI handler
- * Uses <https://github.com/TheKikGen/midiXparser> library
  *
  * @copyright Copyright (c) 2022-2025 Fern Lane
  *
@@ -27,120 +26,740 @@
  */
 
 #include "include/midi.h"
-#include "include/clock.h"
+#include "include/calibration.h"
+#include "include/glide.h"
+#include "include/mod.h"
+#include "include/perf.h"
 #include "include/pins.h"
+#include "include/playout.h"
+#include "include/sysex.h"
+#include "include/timebase.h"
+#include "include/uart.h"
+#include "include/utils.h"
+
+#include <EEPROM.h>
+
+#if VOICE_UNITS_MAX > 7U
+#error "VOICE_UNITS_MAX must be less than 8 (voice numbers are stored as 4-bit values)"
+#endif
+
+// No voice (in `note_voices` and `channel_voices` tables, and voices lists)
+#define VOICE_NONE 0x0FU
 
 // Preinstantiate
 MIDI midi;
 
+// Parser action for each status byte (see `STATUS_INFO`)
+enum class MidiAction : uint8_t { IGNORE, NOTE_OFF, NOTE_ON, CONTROL_CHANGE, PITCH_BEND, SYSEX };
+
+// Packs parser action and number of data bytes into `STATUS_INFO` entry
+#define STATUS_INFO_ACTION_SHIFT 2U
+#define STATUS_INFO_LENGTH_MASK  0x03U
+#define STATUS_INFO_PACK(action, length) \
+    static_cast<uint8_t>((static_cast<uint8_t>(MidiAction::action) << STATUS_INFO_ACTION_SHIFT) | (length))
+
+// Parser table. 0x80-0xE0: channel messages (by upper nibble), 0xF0-0xF7: system common messages
+// NOTE: SysEx data bytes are streamed into `sysex` (see "include/sysex.h") until any other status byte
+constexpr uint8_t STATUS_INFO[15] PROGMEM = {
+    STATUS_INFO_PACK(NOTE_OFF, 2U),       // 0x80 Note OFF
+    STATUS_INFO_PACK(NOTE_ON, 2U),        // 0x90 Note ON
+    STATUS_INFO_PACK(IGNORE, 2U),         // 0xA0 Polyphonic key pressure
+    STATUS_INFO_PACK(CONTROL_CHANGE, 2U), // 0xB0 Control change
+    STATUS_INFO_PACK(IGNORE, 1U),         // 0xC0 Program change
+    STATUS_INFO_PACK(IGNORE, 1U),         // 0xD0 Channel pressure
+    STATUS_INFO_PACK(PITCH_BEND, 2U),     // 0xE0 Pitch bend
+    STATUS_INFO_PACK(SYSEX, 0U),          // 0xF0 SysEx start
+    STATUS_INFO_PACK(IGNORE, 1U),         // 0xF1 MIDI time code quarter frame
+    STATUS_INFO_PACK(IGNORE, 2U),         // 0xF2 Song position pointer
+    STATUS_INFO_PACK(IGNORE, 1U),         // 0xF3 Song select
+    STATUS_INFO_PACK(IGNORE, 0U),         // 0xF4 Undefined
+    STATUS_INFO_PACK(IGNORE, 0U),         // 0xF5 Undefined
+    STATUS_INFO_PACK(IGNORE, 0U),         // 0xF6 Tune request
+    STATUS_INFO_PACK(IGNORE, 0U),         // 0xF7 SysEx end
+};
+
+// Single bit mask by bit number (avoids variable shifts)
+constexpr uint8_t BIT_MASK[8] PROGMEM = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
+
+// Number of the highest set bit of each byte (0 for 0). For the lowest set bit use `BIT_HIGHEST[x & -x]`
+constexpr uint8_t BIT_HIGHEST[256] PROGMEM = {
+    0, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+};
+
+/**
+ * @brief Reads 4-bit value from packed table
+ *
+ * @param table 2 values per byte (even index in lower bits)
+ * @param index value index
+ * @return uint8_t 0-15
+ */
+inline uint8_t get_nibble(const uint8_t *table, uint8_t index) {
+    return index & 0x01U ? table[index >> 1U] >> 4U : table[index >> 1U] & 0x0FU;
+}
+
+/**
+ * @brief Writes 4-bit value into packed table
+ *
+ * @param table 2 values per byte (even index in lower bits)
+ * @param index value index
+ * @param value 0-15
+ */
+inline void set_nibble(uint8_t *table, uint8_t index, uint8_t value) {
+    uint8_t &byte = table[index >> 1U];
+    byte = index & 0x01U ? (byte & 0x0FU) | (value << 4U) : (byte & 0xF0U) | value;
+}
+
 /**
- * @brief Initialises serial port and midiXparser library
+ * @brief Initialises serial port and reads stacked unit index and number of units from EEPROM
  */
 void MIDI::init(void) {
-    MIDI_SERIAL_INIT;
-    voice_parser.setMidiMsgFilter(midiXparser::channelVoiceMsgTypeMsk);
-    clock_parser.setMidiMsgFilter(midiXparser::realTimeMsgTypeMsk);
+    uart.init(MIDI_SERIAL_BAUD);
+    parser_status = 0U;
+    parser_index = 0U;
+    parser_sysex = false;
+    notes_stack_1.top = 255U;
+    notes_stack_2.top = 255U;
+    priority_1 = NOTE_PRIORITY_1;
+    priority_2 = NOTE_PRIORITY_2;
+    voice_mode = VoiceMode::OFF;
+    split = false;
+    uint8_t index = EEPROM.read(EEPROM_ADDR_UNIT_INDEX);
+    uint8_t count = EEPROM.read(EEPROM_ADDR_UNIT_COUNT);
+    if (count == 0U || count > VOICE_UNITS_MAX || index >= count) {
+        index = 0U;
+        count = 1U;
+    }
+    voice_base = index * 2U;
+    voices_n = count * 2U;
+    reset_voices();
+    for (uint8_t i = 0U; i < 16U; ++i)
+        channel_pitch_bend_range[i] = PITCH_BEND_RANGE_DEFAULT * PITCH_SEMITONE;
 }
 
 /**
- * @brief Parses MIDI note ON/OFF and pitch bend events.
- * NOTE: You MUST handle `note_1_event_on` - `note_2_event_off` right after calling this
+ * @brief Parses all pending bytes from the UART receive buffer (MIDI note ON/OFF and pitch bend events).
+ * NOTE: Note events must be consumed using `pop_event()` (or dropped using `clear_events()`) right after calling this
  */
 void MIDI::loop(void) {
-    if (!MIDI_SERIAL_AVAILABLE)
-        return;
-
-    uint8_t data = MIDI_SERIAL_READ;
-
-    // Channel Voice Messages
-    if (voice_parser.parse(data) && voice_parser.getMidiMsgLen() == 3U) {
-        uint8_t channel = voice_parser.getMidiMsg()[0] & 0x0F;
-
-        // Ignore events for other channels outside omni mode
-        if (!omni && channel > 1U)
-            return;
-
-        // Note ON/OFF
-        if (voice_parser.isMidiStatus(midiXparser::noteOnStatus) ||
-            voice_parser.isMidiStatus(midiXparser::noteOffStatus)) {
-            uint8_t note = voice_parser.getMidiMsg()[1] & 0x7F;
-            if (note < NOTE_MIN)
-                return;
-            boolean on = voice_parser.isMidiStatus(midiXparser::noteOnStatus);
-
-            // Ignore OFF events for notes that are already off
-            if (!on && !is_note_enabled(channel, note))
-                return;
-
-            boolean &note_1_event = (on ? note_1_event_on : note_1_event_off);
-            boolean &note_2_event = (on ? note_2_event_on : note_2_event_off);
-
-            // Save event
-            if (omni) {
-                set_note(0U, note, on);
-                set_note(1U, note, on);
-                note_1_event = true;
-                note_2_event = true;
-            } else {
-                set_note(channel, note, on);
-                (channel ? note_2_event : note_1_event) = true;
-            }
+    uint8_t data;
+    uint32_t time;
+#ifdef PLAYOUT
+    // Parse bytes only when their playout time is close and stop after message which outputs are held until they are
+    // queued (see playout.h)
+    while (uart.peek(time) && playout.due(time) && uart.read(data, time)) {
+#else
+    while (uart.read(data, time)) {
+#endif
+#ifdef PERF_PROBES
+        uint16_t start = TCNT1;
+#endif
+        parse(data, time);
+#ifdef PERF_PROBES
+        perf.probe(PerfProbe::PARSE_BYTE, TCNT1 - start);
+#endif
+    }
+}
 
-            // Count number of pressed notes
-            if (channel) {
-                if (on && notes_pressed_n_2 < UINT8_MAX)
-                    notes_pressed_n_2++;
-                else if (!on && notes_pressed_n_2 > 0U)
-                    notes_pressed_n_2--;
-            } else {
-                if (on && notes_pressed_n_1 < UINT8_MAX)
-                    notes_pressed_n_1++;
-                else if (!on && notes_pressed_n_1 > 0U)
-                    notes_pressed_n_1--;
-            }
+/**
+ * @brief Parses one received byte. Single-pass state machine that handles running status and real-time bytes
+ * interleaved anywhere (even inside other messages)
+ *
+ * @param data received byte
+ * @param time byte arrival time (see timebase.h)
+ */
+void MIDI::parse(uint8_t data, uint32_t time) {
+    // Real-time messages (single byte, don't affect running status).
+    // NOTE: Timing clock and transport (Start / Continue / Stop) are handled inside UART receive interrupt
+    if (data >= 0xF8U)
+        return;
 
-            // Save note number
-            // if (on) {
-            if (omni) {
-                note_1 = note;
-                note_2 = note;
-            } else {
-                (channel ? note_2 : note_1) = note;
+    // Status byte -> start new message
+    if (data & 0x80U) {
+        // Any status byte terminates SysEx (normally, it's 0xF7)
+        if (parser_sysex) {
+            parser_sysex = false;
+            if (data == 0xF7U)
+                sysex.end();
+            else {
+                sysex.abort();
+                count_parse_error();
             }
+        }
+
+        // Previous message is incomplete
+        else if (parser_index)
+            count_parse_error();
+
+        parser_status = data;
+        parser_index = 0U;
+        parser_info = pgm_read_byte(&STATUS_INFO[data < 0xF0U ? (data >> 4U) - 8U : (data & 0x07U) + 7U]);
+
+        // No data bytes -> handle it right away. No running status
+        if (!(parser_info & STATUS_INFO_LENGTH_MASK)) {
+            dispatch(time);
+            parser_status = 0U;
+        }
+        return;
+    }
+
+    // SysEx data
+    if (parser_sysex) {
+        sysex.data(data);
+        return;
+    }
+
+    // Data byte without status (garbage)
+    if (!parser_status) {
+        count_parse_error();
+        return;
+    }
+
+    parser_data[parser_index++] = data;
+    if (parser_index < (parser_info & STATUS_INFO_LENGTH_MASK))
+        return;
+
+    // Message complete -> keep status for running status (channel messages only)
+    parser_index = 0U;
+    dispatch(time);
+    if (parser_status >= 0xF0U)
+        parser_status = 0U;
+}
+
+/**
+ * @brief Handles complete message in `parser_status` and `parser_data`
+ *
+ * @param time arrival time of the last byte of message (see timebase.h)
+ */
+void MIDI::dispatch(uint32_t time) {
+    enum MidiAction action = static_cast<enum MidiAction>(parser_info >> STATUS_INFO_ACTION_SHIFT);
+    if (action == MidiAction::IGNORE)
+        return;
+
+    uint8_t channel = parser_status & 0x0FU;
+
+    // Ignore events for other channels outside omni mode
+    if (parser_status < 0xF0U && !omni && channel > 1U)
+        return;
+
+#ifdef PLAYOUT
+    // Hold outputs changed by this message until it's playout time
+    if (action != MidiAction::SYSEX)
+        playout.hold(time);
+#endif
+
+    switch (action) {
+    // Note ON/OFF (note ON with 0 velocity is note OFF)
+    case MidiAction::NOTE_OFF:
+    case MidiAction::NOTE_ON:
+        handle_note(channel, parser_data[0], action == MidiAction::NOTE_ON && parser_data[1] != 0U, time);
+        break;
+
+    // Pitch bend (raw, -8192 to 8191. See `get_voice_pitch_bend()`)
+    case MidiAction::PITCH_BEND:
+        channel_pitch_bend[channel] =
+            static_cast<int16_t>((static_cast<uint16_t>(parser_data[1]) << 7U) | parser_data[0]) - 8192;
+        pitch_bend_channel = channel;
+        pitch_bend_event = true;
+        break;
+
+    case MidiAction::CONTROL_CHANGE:
+        handle_control_change(channel, parser_data[0], parser_data[1]);
+        break;
 
-            note_last = note;
-            //}
+    // SysEx start -> stream data bytes into `sysex`
+    case MidiAction::SYSEX:
+        parser_sysex = true;
+        sysex.start();
+        break;
 
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Handles control change message (all notes off, pitch bend range RPN, portamento and modulation)
+ *
+ * @param channel MIDI channel (0-15)
+ * @param control controller number (0-127)
+ * @param value controller value (0-127)
+ */
+void MIDI::handle_control_change(uint8_t channel, uint8_t control, uint8_t value) {
+    uint16_t channel_mask = 1U << channel;
+    boolean rpn_bend_range = (rpn_msb_zero & rpn_lsb_zero & channel_mask) != 0U;
+
+    switch (control) {
+    // Data entry MSB -> pitch bend range semitones (resets cents)
+    case 6U:
+        if (rpn_bend_range) {
+            channel_pitch_bend_range[channel] = static_cast<uint16_t>(value) * PITCH_SEMITONE;
+            pitch_bend_event = true;
         }
+        break;
 
-        // Pitch bend
-        else if (voice_parser.isMidiStatus(midiXparser::pitchBendStatus)) {
-            // +/- 200 cents (+/- 2 semitones)
-            pitch_bend = static_cast<int16_t>(voice_parser.getMidiMsg()[2] & 0x7F) << 7U;
-            pitch_bend |= static_cast<int16_t>(voice_parser.getMidiMsg()[1] & 0x7F);
-            pitch_bend = (pitch_bend - 8192) / 41;
+    // Data entry LSB -> pitch bend range cents
+    case 38U:
+        if (rpn_bend_range) {
+            uint16_t &range = channel_pitch_bend_range[channel];
+            range = (range & ~(PITCH_SEMITONE - 1U)) |
+                    ((static_cast<uint16_t>(min(value, 99U)) * PITCH_SEMITONE) / 100U);
             pitch_bend_event = true;
         }
+        break;
+
+    // NRPN select -> deselect RPN
+    case 98U:
+    case 99U:
+        rpn_msb_zero &= ~channel_mask;
+        rpn_lsb_zero &= ~channel_mask;
+        break;
+
+    // RPN select (RPN 0 / 0 is pitch bend range)
+    case 100U:
+        if (value)
+            rpn_lsb_zero &= ~channel_mask;
+        else
+            rpn_lsb_zero |= channel_mask;
+        break;
+    case 101U:
+        if (value)
+            rpn_msb_zero &= ~channel_mask;
+        else
+            rpn_msb_zero |= channel_mask;
+        break;
+
+#ifdef MOD
+    // Modulation wheel -> LFO depth
+    case 1U:
+        if (omni || !channel)
+            mod.set_depth(0U, value);
+        if (omni || channel)
+            mod.set_depth(1U, value);
+        break;
+
+    // Vibrato rate
+    case 76U:
+        mod.set_rate(value);
+        break;
+
+#ifdef MOD_ADSR
+    // Envelope of 2nd CV channel is controlled by 1st channel's MIDI channel (it's gated by it)
+    case MOD_ADSR_CC_ATTACK:
+    case MOD_ADSR_CC_DECAY:
+    case MOD_ADSR_CC_SUSTAIN:
+    case MOD_ADSR_CC_RELEASE:
+        if (omni || !channel)
+            mod.set_envelope(control, value);
+        break;
+#endif
+#endif
+
+#ifdef GLIDE
+    // Portamento time (MSB) / portamento ON / OFF
+    case 5U:
+    case 65U:
+        if (omni || !channel) {
+            if (control == 5U)
+                glide.set_time(0U, value);
+            else
+                glide.set_enabled(0U, value >= 64U);
+        }
+        if (omni || channel) {
+            if (control == 5U)
+                glide.set_time(1U, value);
+            else
+                glide.set_enabled(1U, value >= 64U);
+        }
+        break;
+#endif
+
+    // All sound off / all notes off
+    case 120U:
+    case 123U:
+        if (value)
+            break;
+        if (voice_mode != VoiceMode::OFF)
+            reset_voices();
+        if (omni) {
+            panic_1_event = true;
+            panic_2_event = true;
+        } else
+            (channel ? panic_2_event : panic_1_event) = true;
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Handles note ON / OFF message (updates notes states, counters and pushes note event)
+ *
+ * @param channel MIDI channel (0-15)
+ * @param note 0-127
+ * @param on true if note is ON, false if note is OFF
+ * @param time event arrival time (see timebase.h)
+ */
+void MIDI::handle_note(uint8_t channel, uint8_t note, boolean on, uint32_t time) {
+    if (note < NOTE_MIN)
+        return;
+
+    // Distribute between voices
+    if (voice_mode != VoiceMode::OFF) {
+        allocate_note(channel, note, on, time);
+        return;
+    }
+
+    // Ignore OFF events for notes that are already off
+    if (!on && !is_note_enabled(channel, note))
+        return;
+
+    // Save event
+    if (omni) {
+        set_note(0U, note, on);
+        set_note(1U, note, on);
+        push_event(0U, note, on, time);
+        push_event(1U, note, on, time);
+    } else {
+        set_note(channel, note, on);
+        push_event(channel, note, on, time);
+    }
+
+    // Count number of pressed notes
+    if (channel) {
+        if (on && notes_pressed_n_2 < UINT8_MAX)
+            notes_pressed_n_2++;
+        else if (!on && notes_pressed_n_2 > 0U)
+            notes_pressed_n_2--;
+    } else {
+        if (on && notes_pressed_n_1 < UINT8_MAX)
+            notes_pressed_n_1++;
+        else if (!on && notes_pressed_n_1 > 0U)
+            notes_pressed_n_1--;
+    }
+}
+
+/**
+ * @brief Assigns note to one of the voices (see VoiceMode) or releases voice that plays it. Voices of all stacked units
+ * are allocated (see `set_unit()`), but only this unit's voices get note ON / OFF events (just like in direct mode, so
+ * they always have at most 1 enabled note). Takes constant time (voices are taken from the heads of busy / free lists)
+ *
+ * @param channel MIDI channel (0-15)
+ * @param note NOTE_MIN-127
+ * @param on true if note is ON, false if note is OFF
+ * @param time event arrival time (see timebase.h)
+ */
+void MIDI::allocate_note(uint8_t channel, uint8_t note, boolean on, uint32_t time) {
+    // Voice that already plays this note (or any note of this channel in MPE mode)
+    uint8_t voice;
+    if (voice_mode == VoiceMode::MPE) {
+        voice = get_nibble(channel_voices, channel);
+        if (!on && voice != VOICE_NONE && voices[voice].note != note)
+            voice = VOICE_NONE;
+    } else
+        voice = find_voice(channel, note);
+
+    // Note OFF -> release voice (if note was not stolen)
+    if (!on) {
+        if (voice != VOICE_NONE)
+            release_voice(voice, time);
+        return;
+    }
+
+    // Free voice (next one in round-robin mode or the one released earliest) or steal one
+    if (voice == VOICE_NONE) {
+        if (voice_mode == VoiceMode::ROUND_ROBIN && voices[voice_next].note == 255U)
+            voice = voice_next;
+        else if (voices_free.head != VOICE_NONE)
+            voice = voices_free.head;
+        else
+            voice = voice_mode == VoiceMode::ROUND_ROBIN ? voice_next : voices_busy.head;
+    }
+
+    if (voices[voice].note != 255U)
+        release_voice(voice, time);
+
+    voice_list_remove(&voices_free, voice);
+    voice_list_append(&voices_busy, voice);
+    voices[voice].same_note = get_nibble(note_voices, note - NOTE_MIN);
+    set_nibble(note_voices, note - NOTE_MIN, voice);
+    set_nibble(channel_voices, channel, voice);
+    voice_next = voice + 1U < voices_n ? voice + 1U : 0U;
+
+    // Other unit's voice
+    uint8_t local = voice - voice_base;
+    if (local > 1U) {
+        voices[voice].channel = channel;
+        voices[voice].note = note;
+        return;
+    }
+
+    // Apply new channel's pitch bend right away (without ramp)
+    if (voices[voice].channel != channel) {
+        voices[voice].channel = channel;
+        voice_pitch_bends[local].current = calculate_voice_pitch_bend(local);
+        voice_pitch_bends[local].target = voice_pitch_bends[local].current;
+    }
+    voices[voice].note = note;
+    set_note(local, note, true);
+    push_event(local, note, true, time);
+    (local ? notes_pressed_n_2 : notes_pressed_n_1) = 1U;
+}
+
+/**
+ * @brief Turns voice's note OFF and moves voice into the end of free list
+ *
+ * @param voice 0 to number of voices of all units - 1
+ * @param time event arrival time (see timebase.h)
+ */
+void MIDI::release_voice(uint8_t voice, uint32_t time) {
+    uint8_t note = voices[voice].note;
+    voices[voice].note = 255U;
+    voice_list_remove(&voices_busy, voice);
+    voice_list_append(&voices_free, voice);
+    if (get_nibble(channel_voices, voices[voice].channel) == voice)
+        set_nibble(channel_voices, voices[voice].channel, VOICE_NONE);
+
+    // Unlink from voices with the same note (only if note is ON on multiple channels it takes more than 1 step)
+    uint8_t other = get_nibble(note_voices, note - NOTE_MIN);
+    if (other == voice)
+        set_nibble(note_voices, note - NOTE_MIN, voices[voice].same_note);
+    else {
+        while (voices[other].same_note != voice)
+            other = voices[other].same_note;
+        voices[other].same_note = voices[voice].same_note;
+    }
+
+    // Local voice (note could be already cleared by panic)
+    uint8_t local = voice - voice_base;
+    if (local > 1U || !is_note_enabled(local, note))
+        return;
+    set_note(local, note, false);
+    push_event(local, note, false, time);
+    (local ? notes_pressed_n_2 : notes_pressed_n_1) = 0U;
+}
+
+/**
+ * @brief Finds voice that plays note of specific channel
+ *
+ * @param channel MIDI channel (0-15)
+ * @param note NOTE_MIN-127
+ * @return uint8_t voice or VOICE_NONE
+ */
+uint8_t MIDI::find_voice(uint8_t channel, uint8_t note) {
+    uint8_t voice = get_nibble(note_voices, note - NOTE_MIN);
+    while (voice != VOICE_NONE && voices[voice].channel != channel)
+        voice = voices[voice].same_note;
+    return voice;
+}
+
+/**
+ * @brief Releases all voices of all units (without note OFF events) and puts them into free list in order
+ */
+void MIDI::reset_voices(void) {
+    memset(note_voices, 0xFF, sizeof(note_voices));
+    memset(channel_voices, 0xFF, sizeof(channel_voices));
+    voices_busy.head = VOICE_NONE;
+    voices_busy.tail = VOICE_NONE;
+    voices_free.head = VOICE_NONE;
+    voices_free.tail = VOICE_NONE;
+    for (uint8_t voice = 0U; voice < voices_n; ++voice) {
+        voices[voice].note = 255U;
+        voices[voice].channel = 0U;
+        voice_list_append(&voices_free, voice);
+    }
+    voice_next = 0U;
+}
+
+/**
+ * @brief Removes voice from list
+ *
+ * @param list `voices_busy` or `voices_free`
+ * @param voice voice in this list
+ */
+void MIDI::voice_list_remove(struct voiceList *list, uint8_t voice) {
+    uint8_t prev = voices[voice].prev, next = voices[voice].next;
+    if (prev == VOICE_NONE)
+        list->head = next;
+    else
+        voices[prev].next = next;
+    if (next == VOICE_NONE)
+        list->tail = prev;
+    else
+        voices[next].prev = prev;
+}
+
+/**
+ * @brief Appends voice to the end of list
+ *
+ * @param list `voices_busy` or `voices_free`
+ * @param voice voice that is not in any list
+ */
+void MIDI::voice_list_append(struct voiceList *list, uint8_t voice) {
+    voices[voice].prev = list->tail;
+    voices[voice].next = VOICE_NONE;
+    if (list->tail == VOICE_NONE)
+        list->head = voice;
+    else
+        voices[list->tail].next = voice;
+    list->tail = voice;
+}
+
+/**
+ * @brief Changes voice allocation mode. Turns all notes OFF (via `panic_1_event` and `panic_2_event`) if it changed
+ *
+ * @param mode see VoiceMode
+ */
+void MIDI::set_voice_mode(enum VoiceMode mode) {
+    if (mode == voice_mode)
+        return;
+    voice_mode = mode;
+    reset_voices();
+    panic_1_event = true;
+    panic_2_event = true;
+    pitch_bend_event = true;
+}
+
+/**
+ * @brief Sets split mode (both CV channels play notes of 1st MIDI channel, so both follow its pitch bend outside omni
+ * mode). Recalculates voices' pitch bends if it changed
+ *
+ * @param state true if split mode is enabled
+ */
+void MIDI::set_split(boolean state) {
+    if (state == split)
+        return;
+    split = state;
+    pitch_bend_event = true;
+}
+
+/**
+ * @brief Sets index of this unit in the stack of units that share the same MIDI stream and number of units.
+ * Each unit plays voices 2 * index and 2 * index + 1 of 2 * count. Saves them into EEPROM and turns all notes OFF
+ *
+ * @param index 0 to count - 1
+ * @param count 1 to VOICE_UNITS_MAX
+ * @return boolean false if values are out of range
+ */
+boolean MIDI::set_unit(uint8_t index, uint8_t count) {
+    if (count == 0U || count > VOICE_UNITS_MAX || index >= count)
+        return false;
+    EEPROM.update(EEPROM_ADDR_UNIT_INDEX, index);
+    EEPROM.update(EEPROM_ADDR_UNIT_COUNT, count);
+    voice_base = index * 2U;
+    voices_n = count * 2U;
+    reset_voices();
+    panic_1_event = true;
+    panic_2_event = true;
+    pitch_bend_event = true;
+    return true;
+}
 
-        // All notes off event
-        else if (voice_parser.isMidiStatus(midiXparser::controlChangeStatus) &&
-                 (voice_parser.getMidiMsg()[1] == 120U || voice_parser.getMidiMsg()[1] == 123U) &&
-                 voice_parser.getMidiMsg()[2] == 0U) {
-            if (omni) {
-                panic_1_event = true;
-                panic_2_event = true;
-            } else
-                (channel ? panic_2_event : panic_1_event) = true;
+/**
+ * @brief Applies latest pitch bend of each voice (so any number of received pitch bend messages costs one
+ * calculation per loop) and advances pitch bend ramps at fixed rate (if PITCH_BEND_SMOOTHING is defined)
+ *
+ * @return uint8_t mask of voices which applied pitch bend changed (bit 0 - 1st voice, bit 1 - 2nd voice)
+ */
+uint8_t MIDI::update_pitch_bends(void) {
+    uint8_t changed = 0U;
+
+    // New pitch bend or range received
+    if (pitch_bend_event) {
+        pitch_bend_event = false;
+        for (uint8_t voice = 0U; voice < 2U; ++voice) {
+            struct voicePitchBend &bend = voice_pitch_bends[voice];
+            int16_t target = calculate_voice_pitch_bend(voice);
+            if (target == bend.target)
+                continue;
+            bend.target = target;
+#ifdef PITCH_BEND_SMOOTHING
+            bend.step = static_cast<int16_t>((static_cast<int32_t>(target) - bend.current) / PITCH_BEND_RAMP_STEPS);
+            if (bend.step == 0)
+                bend.step = target > bend.current ? 1 : -1;
+#else
+            bend.current = target;
+            changed |= voice ? 0x02U : 0x01U;
+#endif
         }
     }
 
-    // Clock pulse
-    if (clock_parser.parse(data) && clock_parser.isMidiStatus(midiXparser::timingClockStatus))
-        clock.midi_tick();
+#ifdef PITCH_BEND_SMOOTHING
+    // Ramp step (keep fixed rate unless loop is slower than it)
+    uint32_t time = timebase.now();
+    uint32_t elapsed = time - pitch_bend_ramp_time;
+    if (elapsed < PITCH_BEND_RAMP_INTERVAL_US * TIMEBASE_TICKS_PER_US)
+        return changed;
+    if (elapsed < 2UL * PITCH_BEND_RAMP_INTERVAL_US * TIMEBASE_TICKS_PER_US)
+        pitch_bend_ramp_time += PITCH_BEND_RAMP_INTERVAL_US * TIMEBASE_TICKS_PER_US;
+    else
+        pitch_bend_ramp_time = time;
+    for (uint8_t voice = 0U; voice < 2U; ++voice) {
+        struct voicePitchBend &bend = voice_pitch_bends[voice];
+        if (bend.current == bend.target)
+            continue;
+        int32_t left = static_cast<int32_t>(bend.target) - bend.current;
+        if ((bend.step > 0 && bend.step >= left) || (bend.step < 0 && bend.step <= left))
+            bend.current = bend.target;
+        else
+            bend.current += bend.step;
+        changed |= voice ? 0x02U : 0x01U;
+    }
+#endif
+
+    return changed;
+}
+
+/**
+ * @brief Returns applied pitch bend of voice (see `update_pitch_bends()`)
+ *
+ * @param voice 0-1
+ * @return int16_t pitch bend in Q8.8 semitones (see PITCH_SEMITONE)
+ */
+int16_t MIDI::get_voice_pitch_bend(uint8_t voice) { return voice_pitch_bends[voice].current; }
+
+/**
+ * @brief Calculates pitch bend of voice. Outside voice allocation mode it's pitch bend of voice's MIDI channel (1st
+ * one for both voices in split mode, the last received one in omni mode). Otherwise, it's the pitch bend of MIDI
+ * channel of voice's current (or last) note (plus manager channel's pitch bend in MPE mode)
+ *
+ * @param voice 0-1
+ * @return int16_t pitch bend in Q8.8 semitones (see PITCH_SEMITONE)
+ */
+int16_t MIDI::calculate_voice_pitch_bend(uint8_t voice) {
+    uint8_t channel;
+    if (voice_mode == VoiceMode::OFF)
+        channel = omni ? pitch_bend_channel : (split ? 0U : voice);
+    else
+        channel = voices[voice_base + voice].channel;
+
+    // Raw pitch bend is 14-bit signed, so range * raw / 8192
+    int32_t bend = (static_cast<int32_t>(channel_pitch_bend[channel]) * channel_pitch_bend_range[channel]) >> 13U;
+    if (voice_mode == VoiceMode::MPE && channel != VOICE_MPE_MANAGER_CHANNEL)
+        bend += (static_cast<int32_t>(channel_pitch_bend[VOICE_MPE_MANAGER_CHANNEL]) *
+                 channel_pitch_bend_range[VOICE_MPE_MANAGER_CHANNEL]) >>
+                13U;
+    return static_cast<int16_t>(constrain(bend, -INT16_MAX, INT16_MAX));
 }
 
 /**
- * @brief Saves note state into `notes_enabled_1` / `notes_enabled_2`
+ * @brief Saves note state into `notes_enabled_1` / `notes_enabled_2` and `notes_stack_1` / `notes_stack_2`.
+ * Pressing already enabled note moves it to the top of stack
  *
  * @param channel 0 to use `notes_enabled_1`, 1 to use `notes_enabled_2`
  * @param note 0-127
@@ -148,34 +767,46 @@ void MIDI::loop(void) {
  */
 void MIDI::set_note(uint8_t channel, uint8_t note, boolean state) {
     struct notesEnabled *notes_enabled = (channel ? &notes_enabled_2 : &notes_enabled_1);
-    uint64_t note_mask = 1ULL << (note % 64U);
+    uint8_t note_mask = pgm_read_byte(&BIT_MASK[note & 0x07U]);
+
+    if (note >= NOTE_MIN) {
+        struct noteStack *stack = (channel ? &notes_stack_2 : &notes_stack_1);
+        if (notes_enabled->bytes[note >> 3U] & note_mask)
+            stack_remove(stack, note);
+        if (state)
+            stack_push(stack, note);
+    }
+
     if (state)
-        (note > 63U ? notes_enabled->msb : notes_enabled->lsb) |= note_mask;
+        notes_enabled->bytes[note >> 3U] |= note_mask;
     else
-        (note > 63U ? notes_enabled->msb : notes_enabled->lsb) &= ~note_mask;
+        notes_enabled->bytes[note >> 3U] &= ~note_mask;
 }
 
 /**
- * @brief Handles MIDI panic event
+ * @brief Handles MIDI panic event (clears notes and all pending note events). Releases all voices in voice allocation
+ * mode (just like All notes off), so stacked units stay in sync only if all of them are panicked
  *
  * @param channel mask (0 - 1st channel, 1 - 2nd channel, 3 - both channels)
  */
 void MIDI::panic(uint8_t channel) {
+    if (voice_mode != VoiceMode::OFF)
+        reset_voices();
+
     if (channel > 1U) {
-        notes_enabled_1.msb = 0ULL;
-        notes_enabled_1.lsb = 0ULL;
-        notes_enabled_2.msb = 0ULL;
-        notes_enabled_2.lsb = 0ULL;
+        memset(&notes_enabled_1, 0, sizeof(notesEnabled));
+        memset(&notes_enabled_2, 0, sizeof(notesEnabled));
+        notes_stack_1.top = 255U;
+        notes_stack_2.top = 255U;
         notes_pressed_n_1 = 0U;
         notes_pressed_n_2 = 0U;
-        note_1_event_off = true;
-        note_2_event_off = true;
+        clear_events(0U);
+        clear_events(1U);
     } else {
-        struct notesEnabled *notes_enabled = (channel ? &notes_enabled_2 : &notes_enabled_1);
-        notes_enabled->msb = 0ULL;
-        notes_enabled->lsb = 0ULL;
+        memset(channel ? &notes_enabled_2 : &notes_enabled_1, 0, sizeof(notesEnabled));
+        (channel ? notes_stack_2 : notes_stack_1).top = 255U;
         (channel ? notes_pressed_n_2 : notes_pressed_n_1) = 0U;
-        (channel ? note_2_event_off : note_1_event_off) = true;
+        clear_events(channel);
     }
 }
 
@@ -188,12 +819,52 @@ void MIDI::panic(uint8_t channel) {
  */
 boolean MIDI::is_note_enabled(uint8_t channel, uint8_t note) {
     struct notesEnabled *notes_enabled = (channel ? &notes_enabled_2 : &notes_enabled_1);
-    uint64_t note_mask = 1ULL << (note % 64U);
-    return (note > 63U ? notes_enabled->msb : notes_enabled->lsb) & note_mask;
+    return notes_enabled->bytes[note >> 3U] & pgm_read_byte(&BIT_MASK[note & 0x07U]);
+}
+
+/**
+ * @brief Finds lowest enabled note starting from `note` (a byte at a time)
+ *
+ * @param notes_enabled `notes_enabled_1` or `notes_enabled_2`
+ * @param note starting point (will be included)
+ * @return uint8_t note number (note-127) or 255 if there is no enabled notes in this range
+ */
+inline uint8_t find_note_up(const struct notesEnabled *notes_enabled, uint8_t note) {
+    uint8_t index = note >> 3U;
+
+    // Mask out notes below the starting point (all bits >= n)
+    uint8_t bits = notes_enabled->bytes[index] & static_cast<uint8_t>(-pgm_read_byte(&BIT_MASK[note & 0x07U]));
+    while (!bits) {
+        if (++index >= sizeof(notes_enabled->bytes))
+            return 255U;
+        bits = notes_enabled->bytes[index];
+    }
+    return (index << 3U) | pgm_read_byte(&BIT_HIGHEST[bits & static_cast<uint8_t>(-bits)]);
+}
+
+/**
+ * @brief Finds highest enabled note starting from `note` (a byte at a time)
+ *
+ * @param notes_enabled `notes_enabled_1` or `notes_enabled_2`
+ * @param note starting point (will be included)
+ * @return uint8_t note number (0-note) or 255 if there is no enabled notes in this range
+ */
+inline uint8_t find_note_down(const struct notesEnabled *notes_enabled, uint8_t note) {
+    uint8_t index = note >> 3U;
+
+    // Mask out notes above the starting point (all bits <= n)
+    uint8_t bits = notes_enabled->bytes[index] &
+                   static_cast<uint8_t>((pgm_read_byte(&BIT_MASK[note & 0x07U]) << 1U) - 1U);
+    while (!bits) {
+        if (index-- == 0U)
+            return 255U;
+        bits = notes_enabled->bytes[index];
+    }
+    return (index << 3U) | pgm_read_byte(&BIT_HIGHEST[bits]);
 }
 
 /**
- * @brief Cycles though all notes in `notes_enabled_1` / `notes_enabled_2` starting from note_last and
+ * @brief Searches `notes_enabled_1` / `notes_enabled_2` starting from note_last and
  * tries to find next note (for arpeggiator and "omni" mode)
  *
  * @param channel 0 to use `notes_enabled_1`, 1 to use `notes_enabled_2`
@@ -203,23 +874,68 @@ boolean MIDI::is_note_enabled(uint8_t channel, uint8_t note) {
  * @return uint8_t 0-127 (next note or same one) or 255 if ALL notes are off
  */
 uint8_t MIDI::get_next_note(uint8_t channel, uint8_t note_last, boolean up, boolean wrap) {
+#ifdef PERF_PROBES
+    uint16_t start = TCNT1;
+#endif
     struct notesEnabled *notes_enabled = (channel ? &notes_enabled_2 : &notes_enabled_1);
-    uint8_t note = note_last;
-    for (;;) {
-        // Calculate next note number
-        note = up ? (note + 1) % 128 : (note == 0 ? 127 : note - 1);
+    uint8_t note;
+    if (up) {
+        note = note_last < 127U ? find_note_up(notes_enabled, note_last + 1U) : 255U;
+        if (note == 255U && wrap)
+            note = find_note_up(notes_enabled, 0U);
+    } else {
+        note = (note_last > 0U && note_last < 128U) ? find_note_down(notes_enabled, note_last - 1U) : 255U;
+        if (note == 255U && wrap)
+            note = find_note_down(notes_enabled, 127U);
+    }
+#ifdef PERF_PROBES
+    perf.probe(PerfProbe::NOTE_SCAN, TCNT1 - start);
+#endif
+    return note;
+}
+
+/**
+ * @brief Finds lowest enabled note
+ *
+ * @param channel 0 to use `notes_enabled_1`, 1 to use `notes_enabled_2`
+ * @return uint8_t 0-127 or 255 if ALL notes are off
+ */
+uint8_t MIDI::get_lowest_note(uint8_t channel) {
+    return find_note_up(channel ? &notes_enabled_2 : &notes_enabled_1, 0U);
+}
 
-        // Return same note if it's still ON or 255 in case of no ON notes
-        if (note == note_last)
-            return ((note > 63U ? notes_enabled->msb : notes_enabled->lsb) & (1ULL << (note % 64U))) ? note : 255U;
+/**
+ * @brief Finds highest enabled note
+ *
+ * @param channel 0 to use `notes_enabled_1`, 1 to use `notes_enabled_2`
+ * @return uint8_t 0-127 or 255 if ALL notes are off
+ */
+uint8_t MIDI::get_highest_note(uint8_t channel) {
+    return find_note_down(channel ? &notes_enabled_2 : &notes_enabled_1, 127U);
+}
 
-        // Next note found
-        if ((note > 63U ? notes_enabled->msb : notes_enabled->lsb) & (1ULL << (note % 64U)))
-            return note;
+/**
+ * @brief Finds most recently pressed note that is still held
+ *
+ * @param channel 0 to use `notes_stack_1`, 1 to use `notes_stack_2`
+ * @return uint8_t NOTE_MIN-127 or 255 if ALL notes are off
+ */
+uint8_t MIDI::get_last_note(uint8_t channel) { return (channel ? notes_stack_2 : notes_stack_1).top; }
 
-        // Stop without wrap flag
-        if (!wrap && (note == 0U || note == 127U))
-            return 255U;
+/**
+ * @brief Finds note that must be played on channel according to it's priority (`priority_1` / `priority_2`)
+ *
+ * @param channel 0-1
+ * @return uint8_t 0-127 or 255 if ALL notes are off
+ */
+uint8_t MIDI::get_priority_note(uint8_t channel) {
+    switch (channel ? priority_2 : priority_1) {
+    case NotePriority::LOWEST:
+        return get_lowest_note(channel);
+    case NotePriority::HIGHEST:
+        return get_highest_note(channel);
+    default:
+        return get_last_note(channel);
     }
 }
 
@@ -231,5 +947,112 @@ uint8_t MIDI::get_next_note(uint8_t channel, uint8_t note_last, boolean up, bool
  */
 boolean MIDI::get_channel_gate(uint8_t channel) {
     struct notesEnabled *notes_enabled = (channel ? &notes_enabled_2 : &notes_enabled_1);
-    return ((notes_enabled->msb || notes_enabled->lsb) ? true : false);
+    uint8_t bits = 0U;
+    for (uint8_t i = 0U; i < sizeof(notes_enabled->bytes); ++i)
+        bits |= notes_enabled->bytes[i];
+    return bits ? true : false;
+}
+
+/**
+ * @brief Pops oldest note event from channel's queue
+ *
+ * @param channel 0 to use `events_1`, 1 to use `events_2`
+ * @param event oldest event
+ * @return boolean false if there are no more events
+ */
+boolean MIDI::pop_event(uint8_t channel, struct noteEvent &event) {
+    struct noteEventsQueue *queue = (channel ? &events_2 : &events_1);
+    if (queue->tail == queue->head)
+        return false;
+
+    event = queue->events[queue->tail];
+    queue->tail = (queue->tail + 1U) & (NOTE_EVENTS_QUEUE_SIZE - 1U);
+    return true;
+}
+
+/**
+ * @brief Drops all pending note events of channel
+ *
+ * @param channel 0 to use `events_1`, 1 to use `events_2`
+ */
+void MIDI::clear_events(uint8_t channel) {
+    struct noteEventsQueue *queue = (channel ? &events_2 : &events_1);
+    queue->tail = queue->head;
+}
+
+/**
+ * @brief Puts note on top of the stack
+ *
+ * @param stack `notes_stack_1` or `notes_stack_2`
+ * @param note NOTE_MIN-127 (must not be in stack)
+ */
+void MIDI::stack_push(struct noteStack *stack, uint8_t note) {
+    stack->prev[note - NOTE_MIN] = stack->top;
+    stack->next[note - NOTE_MIN] = 255U;
+    if (stack->top != 255U)
+        stack->next[stack->top - NOTE_MIN] = note;
+    stack->top = note;
+}
+
+/**
+ * @brief Unlinks note from any position of the stack
+ *
+ * @param stack `notes_stack_1` or `notes_stack_2`
+ * @param note NOTE_MIN-127 (must be in stack)
+ */
+void MIDI::stack_remove(struct noteStack *stack, uint8_t note) {
+    uint8_t prev = stack->prev[note - NOTE_MIN];
+    uint8_t next = stack->next[note - NOTE_MIN];
+    if (prev != 255U)
+        stack->next[prev - NOTE_MIN] = next;
+    if (next != 255U)
+        stack->prev[next - NOTE_MIN] = prev;
+    else
+        stack->top = prev;
+}
+
+/**
+ * @brief Counts malformed message into `perf.counters`
+ */
+void MIDI::count_parse_error(void) {
+    if (perf.counters.parse_errors < UINT16_MAX)
+        perf.counters.parse_errors++;
+}
+
+/**
+ * @brief Pushes note event into channel's queue together with channel's priority, lowest and highest notes (must be
+ * called after `set_note()`). Counts event into `perf.counters` if queue is full
+ *
+ * @param channel 0 to use `events_1`, 1 to use `events_2`
+ * @param note 0-127
+ * @param on true if note is ON, false if note is OFF
+ * @param time event arrival time (see timebase.h)
+ */
+void MIDI::push_event(uint8_t channel, uint8_t note, boolean on, uint32_t time) {
+    struct noteEventsQueue *queue = (channel ? &events_2 : &events_1);
+    uint8_t head_next = (queue->head + 1U) & (NOTE_EVENTS_QUEUE_SIZE - 1U);
+    if (head_next == queue->tail) {
+        if (perf.counters.events_dropped < UINT16_MAX)
+            perf.counters.events_dropped++;
+        return;
+    }
+
+    struct noteEvent &event = queue->events[queue->head];
+    event.note = note;
+    event.on = on;
+    event.lowest = get_lowest_note(channel);
+    event.highest = get_highest_note(channel);
+    switch (channel ? priority_2 : priority_1) {
+    case NotePriority::LOWEST:
+        event.priority = event.lowest;
+        break;
+    case NotePriority::HIGHEST:
+        event.priority = event.highest;
+        break;
+    default:
+        event.priority = get_last_note(channel);
+        break;
+    }
+    event.time = time;
+    queue->head = head_next;
 }
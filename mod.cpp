@@ -0,0 +1,296 @@
+/**
+ * @file mod.cpp
+ * @author Fern Lane
+ * @brief Fixed-point modulation engine (vibrato LFO and ADSR envelope) in DAC_ENGINE interrupt
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "include/mod.h"
+#include "include/dac.h"
+#include "include/gate_trig.h"
+#include "include/pins.h"
+#include "include/utils.h"
+
+#if defined(MOD) && !defined(DAC_ENGINE)
+#error "MOD requires DAC_ENGINE (see include/dac.h)"
+#endif
+
+#if defined(MOD_ADSR) && !defined(MOD)
+#error "MOD_ADSR requires MOD"
+#endif
+
+#if MOD_LFO_DEPTH_MAX_CENTS > 200UL
+#error "MOD_LFO_DEPTH_MAX_CENTS must be 200 or less"
+#endif
+
+// Full LFO cycle (-127 to 127)
+constexpr int8_t LFO_SINE[256] PROGMEM = {
+    0, 3, 6, 9, 12, 16, 19, 22, 25, 28, 31, 34, 37, 40, 43, 46,
+    49, 51, 54, 57, 60, 63, 65, 68, 71, 73, 76, 78, 81, 83, 85, 88,
+    90, 92, 94, 96, 98, 100, 102, 104, 106, 107, 109, 111, 112, 113, 115, 116,
+    117, 118, 120, 121, 122, 122, 123, 124, 125, 125, 126, 126, 126, 127, 127, 127,
+    127, 127, 127, 127, 126, 126, 126, 125, 125, 124, 123, 122, 122, 121, 120, 118,
+    117, 116, 115, 113, 112, 111, 109, 107, 106, 104, 102, 100, 98, 96, 94, 92,
+    90, 88, 85, 83, 81, 78, 76, 73, 71, 68, 65, 63, 60, 57, 54, 51,
+    49, 46, 43, 40, 37, 34, 31, 28, 25, 22, 19, 16, 12, 9, 6, 3,
+    0, -3, -6, -9, -12, -16, -19, -22, -25, -28, -31, -34, -37, -40, -43, -46,
+    -49, -51, -54, -57, -60, -63, -65, -68, -71, -73, -76, -78, -81, -83, -85, -88,
+    -90, -92, -94, -96, -98, -100, -102, -104, -106, -107, -109, -111, -112, -113, -115, -116,
+    -117, -118, -120, -121, -122, -122, -123, -124, -125, -125, -126, -126, -126, -127, -127, -127,
+    -127, -127, -127, -127, -126, -126, -126, -125, -125, -124, -123, -122, -122, -121, -120, -118,
+    -117, -116, -115, -113, -112, -111, -109, -107, -106, -104, -102, -100, -98, -96, -94, -92,
+    -90, -88, -85, -83, -81, -78, -76, -73, -71, -68, -65, -63, -60, -57, -54, -51,
+    -49, -46, -43, -40, -37, -34, -31, -28, -25, -22, -19, -16, -12, -9, -6, -3
+};
+
+// Preinstantiate
+Mod mod;
+
+/**
+ * @brief Adds LFO sample to DAC code
+ *
+ * @param value DAC code
+ * @param depth LFO amplitude in Q8.8 DAC codes
+ * @param sample LFO sample (-127 to 127)
+ * @return uint16_t clamped DAC code
+ */
+static inline uint16_t add_lfo(uint16_t value, int16_t depth, int8_t sample) {
+    int16_t code = value + static_cast<int16_t>((static_cast<int32_t>(depth) * sample + 0x4000L) >> 15U);
+    return code < 0 ? 0U : (code > static_cast<int16_t>(DAC_MAX) ? DAC_MAX : code);
+}
+
+/**
+ * @brief Sets default LFO and envelope parameters (LFO depth is 0 until CC1 is received)
+ */
+void Mod::init(void) {
+    lfo_shape = MOD_LFO_SHAPE;
+    rate = 64U;
+    attack = MOD_ADSR_ATTACK_DEFAULT;
+    decay = MOD_ADSR_DECAY_DEFAULT;
+    sustain = MOD_ADSR_SUSTAIN_DEFAULT;
+    release = MOD_ADSR_RELEASE_DEFAULT;
+    changed = true;
+
+#ifdef MOD_ADSR
+    // Envelope follows gate and trigger outputs of 1st channel (so it's in sync with them, including PLAYOUT)
+    gate_out_reg = portOutputRegister(digitalPinToPort(PIN_GATE_1));
+    trig_out_reg = portOutputRegister(digitalPinToPort(PIN_TRIG_1));
+    gate_mask = digitalPinToBitMask(PIN_GATE_1);
+    trig_mask = digitalPinToBitMask(PIN_TRIG_1);
+#ifdef GATE_1_INVERTED
+    gate_invert = gate_mask;
+#endif
+#ifdef TRIG_1_INVERTED
+    trig_invert = trig_mask;
+#endif
+#endif
+}
+
+/**
+ * @brief Sets LFO depth of channel
+ *
+ * @param channel 0 or 1
+ * @param value MIDI CC1 value (0-127, see MOD_LFO_DEPTH_MAX_CENTS)
+ */
+void Mod::set_depth(uint8_t channel, uint8_t value) {
+    (channel ? depth_2 : depth_1) = value;
+    changed = true;
+}
+
+/**
+ * @brief Sets LFO rate of both channels
+ *
+ * @param value MIDI CC76 value (0-127, see MOD_LFO_RATE_MIN and MOD_LFO_RATE_MAX)
+ */
+void Mod::set_rate(uint8_t value) {
+    rate = value;
+    changed = true;
+}
+
+/**
+ * @brief Sets one of the envelope parameters
+ *
+ * @param control MOD_ADSR_CC_ATTACK, MOD_ADSR_CC_DECAY, MOD_ADSR_CC_SUSTAIN or MOD_ADSR_CC_RELEASE
+ * @param value MIDI CC value (0-127)
+ */
+void Mod::set_envelope(uint8_t control, uint8_t value) {
+    if (control == MOD_ADSR_CC_ATTACK)
+        attack = value;
+    else if (control == MOD_ADSR_CC_DECAY)
+        decay = value;
+    else if (control == MOD_ADSR_CC_SUSTAIN)
+        sustain = value;
+    else if (control == MOD_ADSR_CC_RELEASE)
+        release = value;
+    changed = true;
+}
+
+/**
+ * @brief Converts controller value into number of samples at DAC_ENGINE_RATE_HZ
+ *
+ * @param value MIDI CC value (0-127, see MOD_ADSR_TIME_MAX_MS)
+ * @return uint32_t number of samples
+ */
+uint32_t Mod::time_to_samples(uint8_t value) {
+    uint32_t time_ms = (MOD_ADSR_TIME_MAX_MS * value * value) / (127UL * 127UL);
+    return (time_ms * DAC_ENGINE_RATE_HZ) / 1000UL;
+}
+
+/**
+ * @brief Calculates fraction of remaining distance per sample of exponential segment (4 time constants long)
+ *
+ * @param samples segment length
+ * @return uint16_t Q0.16 coefficient (at least 1)
+ */
+uint16_t Mod::samples_to_coefficient(uint32_t samples) {
+    if (samples == 0U)
+        return UINT16_MAX;
+    uint32_t coefficient = static_cast<uint32_t>((1.f - expf(-4.f / static_cast<float>(samples))) * 65536.f + .5f);
+    return coefficient < 1U ? 1U : (coefficient > UINT16_MAX ? UINT16_MAX : coefficient);
+}
+
+/**
+ * @brief Recalculates interrupt parameters if controllers or DAC scales changed (floats and divisions are used only
+ * here). Must be called from main loop (see `DAC::calculate_compensation()`)
+ *
+ * @param scale_1 1st DAC scale (DAC codes per Q14.2 mV in Q0.16, see DAC_SCALE_SHIFT)
+ * @param scale_2 2nd DAC scale
+ */
+void Mod::update(uint16_t scale_1, uint16_t scale_2) {
+    if (!changed && scale_1 == scale_1_last && scale_2 == scale_2_last)
+        return;
+    changed = false;
+    scale_1_last = scale_1;
+    scale_2_last = scale_2;
+
+    // Interrupt reads only front parameters, so back ones can be filled without disabling interrupts
+    uint8_t back = params_front ^ 1U;
+    volatile struct modParams &params_ = params[back];
+
+    // Q0.16 cycles per sample
+    uint32_t rate_centihertz = MOD_LFO_RATE_MIN + ((MOD_LFO_RATE_MAX - MOD_LFO_RATE_MIN) * rate) / 127UL;
+    params_.lfo_increment = (rate_centihertz << 16U) / (DAC_ENGINE_RATE_HZ * 100UL);
+    params_.lfo_triangle = lfo_shape == LfoShape::TRIANGLE;
+
+    // DAC codes per 1V (Q12.16) -> Q8.8 DAC codes of max depth -> Q8.8 DAC codes of CC1 depth
+    for (uint8_t channel = 0U; channel < 2U; ++channel) {
+        uint32_t volt = static_cast<uint32_t>(MV_Q2_ONE) * 1000UL * (channel ? scale_2 : scale_1);
+        uint32_t depth = (((volt / 1200UL) * MOD_LFO_DEPTH_MAX_CENTS) >> 8U) * (channel ? depth_2 : depth_1) / 127UL;
+        if (depth > INT16_MAX)
+            depth = INT16_MAX;
+        (channel ? params_.lfo_depth_2 : params_.lfo_depth_1) = depth;
+    }
+
+    // Envelope
+    uint32_t attack_samples = time_to_samples(attack);
+    params_.attack_step = attack_samples ? MOD_ADSR_LEVEL_ONE / attack_samples : MOD_ADSR_LEVEL_ONE;
+    params_.decay_coefficient = samples_to_coefficient(time_to_samples(decay));
+    params_.release_coefficient = samples_to_coefficient(time_to_samples(release));
+    params_.sustain = (MOD_ADSR_LEVEL_ONE * sustain) / 127UL;
+    uint32_t level_code = (MOD_ADSR_LEVEL_MV * MV_Q2_ONE * scale_2) >> DAC_SCALE_SHIFT;
+    params_.level_code = level_code > DAC_MAX ? DAC_MAX : level_code;
+
+    params_front = back;
+}
+
+/**
+ * @brief Adds LFO to DAC codes and replaces 2nd one with envelope (if MOD_ADSR is enabled). Must be called from
+ * DAC_ENGINE interrupt only. Integer-only, worst case ~70 cycles for LFO of both channels and ~110 for envelope
+ * (estimated from instruction counts)
+ *
+ * @param value_1 1st channel DAC code
+ * @param value_2 2nd channel DAC code
+ */
+void Mod::tick(uint16_t &value_1, uint16_t &value_2) {
+    volatile struct modParams &params_ = params[params_front];
+
+    // LFO sample (-127 to 127). Triangle is calculated from phase (shifted by 1/4 to start from 0 as sine)
+    lfo_phase += params_.lfo_increment;
+    uint8_t index = lfo_phase >> 8U;
+    int8_t sample;
+    if (params_.lfo_triangle) {
+        index += 64U;
+        sample = static_cast<int8_t>((index < 128U ? index : 255U - index) * 2U - 127U);
+    } else
+        sample = pgm_read_byte(&LFO_SINE[index]);
+
+    value_1 = add_lfo(value_1, params_.lfo_depth_1, sample);
+
+#ifdef MOD_ADSR
+    // Gate ON (or trigger while gate is ON) -> attack (from current level), gate OFF -> release
+    uint8_t gate = (*gate_out_reg ^ gate_invert) & gate_mask;
+    uint8_t trig = (*trig_out_reg ^ trig_invert) & trig_mask;
+    if (gate && (!gate_last || (trig && !trig_last)))
+        stage = AdsrStage::ATTACK;
+    else if (!gate && gate_last)
+        stage = AdsrStage::RELEASE;
+    gate_last = gate;
+    trig_last = trig;
+
+    // Exponential segments: distance * coefficient >> 16 (distance is at most 2^24)
+    uint32_t distance, delta;
+    switch (stage) {
+    case AdsrStage::ATTACK:
+        if (level >= MOD_ADSR_LEVEL_ONE - params_.attack_step) {
+            level = MOD_ADSR_LEVEL_ONE;
+            stage = AdsrStage::DECAY;
+        } else
+            level += params_.attack_step;
+        break;
+
+    case AdsrStage::DECAY:
+        if (level <= params_.sustain) {
+            stage = AdsrStage::SUSTAIN;
+            break;
+        }
+        distance = level - params_.sustain;
+        delta = ((distance >> 9U) * params_.decay_coefficient) >> 7U;
+        if (delta == 0U || delta >= distance) {
+            level = params_.sustain;
+            stage = AdsrStage::SUSTAIN;
+        } else
+            level -= delta;
+        break;
+
+    case AdsrStage::SUSTAIN:
+        level = params_.sustain;
+        break;
+
+    case AdsrStage::RELEASE:
+        delta = ((level >> 9U) * params_.release_coefficient) >> 7U;
+        if (delta == 0U || delta >= level) {
+            level = 0U;
+            stage = AdsrStage::IDLE;
+        } else
+            level -= delta;
+        break;
+
+    default:
+        break;
+    }
+
+    value_2 = (static_cast<uint32_t>(level >> 9U) * params_.level_code) >> 15U;
+#else
+    value_2 = add_lfo(value_2, params_.lfo_depth_2, sample);
+#endif
+}
@@ -0,0 +1,116 @@
+/**
+ * @file perf.cpp
+ * @author Fern Lane
+ * @brief Runtime performance counters (readable over SysEx, see docs/SYSEX.md)
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "include/perf.h"
+#include "include/timebase.h"
+
+#include <util/atomic.h>
+
+#ifdef PERF_PROBES
+// CPU cycles per timebase tick (probes resolution)
+#define PERF_CYCLES_PER_TICK (F_CPU / 1000000UL / TIMEBASE_TICKS_PER_US)
+#endif
+
+// Preinstantiate
+Perf perf;
+
+/**
+ * @brief Measures period of main loop (max and moving average). Must be called once at the beginning of `loop()`
+ */
+void Perf::loop(void) {
+    uint32_t time = timebase.now();
+    uint32_t period = (time - loop_time) / TIMEBASE_TICKS_PER_US;
+    boolean first = loop_time == 0U;
+    loop_time = time;
+    if (first)
+        return;
+
+    if (period > UINT16_MAX)
+        period = UINT16_MAX;
+
+    // Moving average over ~16 loops (sum is 256 x average)
+    loop_avg_sum = loop_avg_sum + (period << 4U) - (loop_avg_sum >> 4U);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (period > counters.loop_max)
+            counters.loop_max = period;
+        counters.loop_avg = loop_avg_sum >> 8U;
+    }
+}
+
+/**
+ * @brief Copies all counters at once. Safe to call while counters are being updated from interrupts
+ *
+ * @param snapshot copy of counters
+ * @param reset true to clear counters after copying
+ */
+void Perf::read(struct perfCounters &snapshot, boolean reset) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memcpy(&snapshot, const_cast<const struct perfCounters *>(&counters), sizeof(perfCounters));
+        if (reset)
+            memset(const_cast<struct perfCounters *>(&counters), 0, sizeof(perfCounters));
+#ifdef PERF_PROBES
+        for (uint8_t i = 0U; i < PERF_PROBES_N; ++i) {
+            snapshot.probe_avg[i] = probe_count[i] ? probe_ticks[i] * PERF_CYCLES_PER_TICK / probe_count[i] : 0U;
+            if (reset) {
+                probe_ticks[i] = 0U;
+                probe_count[i] = 0U;
+            }
+        }
+#endif
+    }
+    snapshot.version = PERF_VERSION;
+#ifdef PERF_PROBES
+    snapshot.version |= PERF_VERSION_PROBES;
+#endif
+    if (reset)
+        loop_avg_sum = 0U;
+}
+
+#ifdef PERF_PROBES
+/**
+ * @brief Records one measurement of code section. Measure it as `uint16_t start = TCNT1;` before the section and
+ * `perf.probe(PerfProbe::..., TCNT1 - start);` after it (resolution is one timebase tick, 8 cycles @ 16MHz, average
+ * of many measurements is finer). Safe to call from interrupts
+ *
+ * @param probe measured code section
+ * @param ticks duration in timebase ticks (see timebase.h)
+ */
+void Perf::probe(enum PerfProbe probe, uint16_t ticks) {
+    uint8_t index = static_cast<uint8_t>(probe);
+    uint32_t cycles = static_cast<uint32_t>(ticks) * PERF_CYCLES_PER_TICK;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (cycles > counters.probe_max[index])
+            counters.probe_max[index] = cycles > UINT16_MAX ? UINT16_MAX : cycles;
+
+        // Average covers measurements until one of it's sums would overflow
+        if (probe_count[index] < UINT16_MAX && probe_ticks[index] <= UINT32_MAX - ticks) {
+            probe_ticks[index] += ticks;
+            probe_count[index]++;
+        }
+    }
+}
+#endif
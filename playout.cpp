@@ -0,0 +1,144 @@
+/**
+ * @file playout.cpp
+ * @author Fern Lane
+ * @brief Fixed-latency playout of received MIDI messages (jitter buffer)
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "include/playout.h"
+#include "include/dac.h"
+#include "include/gate_trig.h"
+#include "include/perf.h"
+#include "include/timebase.h"
+
+#include <util/atomic.h>
+
+#if PLAYOUT_LEAD_US >= PLAYOUT_DELAY_US
+#error "PLAYOUT_LEAD_US must be less than PLAYOUT_DELAY_US"
+#endif
+
+// Preinstantiate
+Playout playout;
+
+/**
+ * @brief Checks if received byte must be parsed now (it's playout time is within PLAYOUT_LEAD_US, previous message's
+ * outputs are already queued and there is a free slot for them)
+ *
+ * @param time arrival time of byte (see timebase.h)
+ * @return boolean true to parse it
+ */
+boolean Playout::due(uint32_t time) {
+    if (held || ((queue_tail + 1U) & PLAYOUT_QUEUE_MASK) == queue_head)
+        return false;
+    uint32_t parse_time = time + (PLAYOUT_DELAY_US - PLAYOUT_LEAD_US) * TIMEBASE_TICKS_PER_US;
+    return static_cast<int32_t>(timebase.now() - parse_time) >= 0;
+}
+
+/**
+ * @brief Checks if there are outputs waiting for their playout time. Main loop must not write DAC (and update LEDs)
+ * meanwhile
+ *
+ * @return boolean true if message's outputs are held or queued
+ */
+boolean Playout::pending(void) { return held || queue_head != queue_tail; }
+
+/**
+ * @brief Holds gates and DAC output until playout time of message. Must be called right after parsing a message that
+ * can change outputs. Main loop must stop parsing until they are queued by `loop()` (see `due()`)
+ *
+ * @param time arrival time of message's last byte (see timebase.h)
+ */
+void Playout::hold(uint32_t time) {
+    if (held)
+        return;
+    deadline = time + PLAYOUT_DELAY_US * TIMEBASE_TICKS_PER_US;
+
+    // Alarm releases gates after the last snapshot only if nothing is held
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        held = true;
+        gate_trig.held = true;
+    }
+}
+
+/**
+ * @brief Calculates held DAC values and queues them with gates and triggers until their playout time. Must be called
+ * at the end of `loop()` instead of `dac.calculate_compensation()` and `dac.write()` while `pending()`
+ */
+void Playout::loop(void) {
+    if (!held)
+        return;
+
+    // Slot at tail is free (see `due()`) and is not read by alarm until tail moves
+    struct playoutSnapshot &snapshot = queue[queue_tail];
+    dac.calculate_compensation();
+    dac.get_frame(snapshot.frame);
+    snapshot.gates = gate_trig.snapshot();
+    snapshot.deadline = deadline;
+
+    // Missed deadline -> play right now and count it
+    int32_t late = static_cast<int32_t>(timebase.now() - deadline);
+    if (late > 0) {
+        uint32_t late_us = static_cast<uint32_t>(late) / TIMEBASE_TICKS_PER_US;
+        if (late_us > UINT16_MAX)
+            late_us = UINT16_MAX;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            if (perf.counters.late_events < UINT16_MAX)
+                perf.counters.late_events++;
+            if (late_us > perf.counters.late_max)
+                perf.counters.late_max = late_us;
+        }
+    }
+
+    // Alarm is armed only for the first snapshot in queue, next ones are armed by alarm itself
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        boolean idle = queue_head == queue_tail;
+        queue_tail = (queue_tail + 1U) & PLAYOUT_QUEUE_MASK;
+        held = false;
+        if (idle)
+            timebase.set_alarm(TIMEBASE_ALARM_PLAYOUT, deadline, isr);
+    }
+}
+
+/**
+ * @brief Writes queued DAC values and gates at their playout time (snapshots which playout times are too close to arm
+ * the alarm are written at once). Releases gates after the last one if nothing is held
+ */
+void Playout::handle_alarm(void) {
+    do {
+        struct playoutSnapshot &snapshot = queue[queue_head];
+        dac.write_frame(snapshot.frame);
+        gate_trig.play(snapshot.gates);
+        queue_head = (queue_head + 1U) & PLAYOUT_QUEUE_MASK;
+    } while (queue_head != queue_tail &&
+             static_cast<int32_t>(timebase.now() - queue[queue_head].deadline) > -TIMEBASE_ALARM_MIN_TICKS);
+
+    if (queue_head != queue_tail)
+        timebase.set_alarm(TIMEBASE_ALARM_PLAYOUT, queue[queue_head].deadline, isr);
+    else if (!held)
+        gate_trig.release();
+}
+
+/**
+ * @brief Static alarm callback (wrapper for `handle_alarm()`)
+ */
+void Playout::isr(void) { playout.handle_alarm(); }
@@ -0,0 +1,282 @@
+/**
+ * @file sysex.cpp
+ * @author Fern Lane
+ * @brief SysEx commands (calibration backup and restore)
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "include/sysex.h"
+#include "include/calibration.h"
+#include "include/midi.h"
+#include "include/uart.h"
+
+// Preinstantiate
+SysEx sysex;
+
+/**
+ * @brief Handles SysEx start (0xF0) byte
+ */
+void SysEx::start(void) {
+    // Previous message was not terminated properly
+    abort();
+    rx_state = SysExRxState::MANUFACTURER;
+}
+
+/**
+ * @brief Handles SysEx data byte (0x00-0x7F)
+ *
+ * @param data received byte
+ */
+void SysEx::data(uint8_t data) {
+    switch (rx_state) {
+    case SysExRxState::MANUFACTURER:
+        rx_state = data == SYSEX_MANUFACTURER_ID ? SysExRxState::DEVICE : SysExRxState::IDLE;
+        break;
+
+    case SysExRxState::DEVICE:
+        rx_state = data == SYSEX_DEVICE_ID ? SysExRxState::COMMAND : SysExRxState::IDLE;
+        break;
+
+    case SysExRxState::COMMAND:
+        rx_command = data;
+        rx_state = SysExRxState::PAYLOAD;
+        rx_index = 0U;
+        rx_group_pos = 0U;
+        rx_checksum = 0U;
+        rx_checksum_received = 0U;
+        rx_checksum_n = 0U;
+        break;
+
+    case SysExRxState::PAYLOAD:
+        if (rx_command == SYSEX_CMD_CALIB_DATA)
+            receive_calib(data);
+        else if (rx_command == SYSEX_CMD_SET_UNIT || rx_command == SYSEX_CMD_PERF_REQUEST) {
+            if (rx_index < sizeof(rx_args))
+                rx_args[rx_index] = data;
+            rx_index++;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Handles SysEx end (0xF7) byte. Executes received command
+ */
+void SysEx::end(void) {
+    if (rx_state == SysExRxState::PAYLOAD) {
+        if (rx_command == SYSEX_CMD_CALIB_REQUEST)
+            start_transmit(SYSEX_CMD_CALIB_DATA, CALIB_BACKUP_SIZE);
+        else if (rx_command == SYSEX_CMD_PERF_REQUEST && tx_state == SysExTxState::IDLE) {
+            // Optional argument: 1 to reset counters after reading them
+            perf.read(tx_perf, rx_index && rx_args[0] == 1U);
+            start_transmit(SYSEX_CMD_PERF_DATA, sizeof(tx_perf));
+        } else if (rx_command == SYSEX_CMD_CALIB_DATA)
+            finish_calib(false);
+        else if (rx_command == SYSEX_CMD_SET_UNIT)
+            finish_unit();
+    }
+    rx_state = SysExRxState::IDLE;
+}
+
+/**
+ * @brief Handles SysEx interrupted by other status byte. Reverts partially received data
+ */
+void SysEx::abort(void) {
+    if (rx_state == SysExRxState::PAYLOAD && rx_command == SYSEX_CMD_CALIB_DATA)
+        finish_calib(true);
+    rx_state = SysExRxState::IDLE;
+}
+
+/**
+ * @brief Decodes calibration backup image byte-by-byte directly into calibration data
+ * (see `Calibration::backup_write()`) followed by 14-bit checksum (MSB first)
+ *
+ * @param data received byte
+ */
+void SysEx::receive_calib(uint8_t data) {
+    // Checksum
+    if (rx_index >= CALIB_BACKUP_SIZE) {
+        rx_checksum_received = (rx_checksum_received << 7U) | data;
+        if (rx_checksum_n < UINT8_MAX)
+            rx_checksum_n++;
+        return;
+    }
+
+    // Group MSBs
+    if (rx_group_pos == 0U) {
+        rx_group_msbs = data;
+        rx_group_pos++;
+        return;
+    }
+
+    uint8_t value = data | ((rx_group_msbs << (8U - rx_group_pos)) & 0x80U);
+    calibration.backup_write(rx_index++, value);
+    rx_checksum += value;
+    rx_group_pos = rx_group_pos < SYSEX_PACK_GROUP ? rx_group_pos + 1U : 0U;
+}
+
+/**
+ * @brief Checks received calibration backup image, saves or reverts it and sends ACK
+ *
+ * @param aborted true if message was interrupted by other status byte
+ */
+void SysEx::finish_calib(boolean aborted) {
+    if (aborted)
+        ack_status = SYSEX_ACK_ERROR_ABORTED;
+    else if (rx_index != CALIB_BACKUP_SIZE || rx_checksum_n != 2U)
+        ack_status = SYSEX_ACK_ERROR_LENGTH;
+    else if (rx_checksum_received != (rx_checksum & 0x3FFFU))
+        ack_status = SYSEX_ACK_ERROR_CHECKSUM;
+    else
+        ack_status = SYSEX_ACK_OK;
+
+    calibration.backup_commit(ack_status == SYSEX_ACK_OK);
+    ack_command = SYSEX_CMD_CALIB_DATA;
+    ack_pending = true;
+}
+
+/**
+ * @brief Applies received unit index and number of units (see `MIDI::set_unit()`) and sends ACK
+ */
+void SysEx::finish_unit(void) {
+    if (rx_index != sizeof(rx_args))
+        ack_status = SYSEX_ACK_ERROR_LENGTH;
+    else if (!midi.set_unit(rx_args[0], rx_args[1]))
+        ack_status = SYSEX_ACK_ERROR_VALUE;
+    else
+        ack_status = SYSEX_ACK_OK;
+
+    ack_command = SYSEX_CMD_SET_UNIT;
+    ack_pending = true;
+}
+
+/**
+ * @brief Starts sending data message (if no other one is being sent)
+ *
+ * @param command SYSEX_CMD_CALIB_DATA (backup image) or SYSEX_CMD_PERF_DATA (`tx_perf`)
+ * @param size data size in bytes (before packing)
+ */
+void SysEx::start_transmit(uint8_t command, uint16_t size) {
+    if (tx_state != SysExTxState::IDLE)
+        return;
+    tx_state = SysExTxState::HEADER;
+    tx_command = command;
+    tx_size = size;
+    tx_pos = 0U;
+}
+
+/**
+ * @brief Reads byte of data that is being sent
+ *
+ * @param index byte index
+ * @return uint8_t byte of calibration backup image or performance counters
+ */
+uint8_t SysEx::read_data(uint16_t index) {
+    if (tx_command == SYSEX_CMD_PERF_DATA)
+        return reinterpret_cast<const uint8_t *>(&tx_perf)[index];
+    return calibration.backup_read(index);
+}
+
+/**
+ * @brief Generates next byte of data message (packed data and checksum)
+ *
+ * @return uint8_t byte to send
+ */
+uint8_t SysEx::transmit_data(void) {
+    // Group MSBs
+    if (tx_pos == 0U) {
+        uint8_t msbs = 0U;
+        for (uint8_t i = 0U; i < SYSEX_PACK_GROUP && tx_index + i < tx_size; ++i)
+            if (read_data(tx_index + i) & 0x80U)
+                msbs |= 1U << i;
+        tx_pos++;
+        return msbs;
+    }
+
+    uint8_t value = read_data(tx_index++);
+    tx_checksum += value;
+    tx_pos = tx_pos < SYSEX_PACK_GROUP ? tx_pos + 1U : 0U;
+    if (tx_index >= tx_size) {
+        tx_state = SysExTxState::CHECKSUM;
+        tx_pos = 0U;
+    }
+    return value & 0x7FU;
+}
+
+/**
+ * @brief Streams pending replies into UART transmit buffer without blocking. Must be called inside `loop()`
+ */
+void SysEx::loop(void) {
+    // ACK (whole message at once, only between dumps)
+    if (ack_pending && tx_state == SysExTxState::IDLE && uart.tx_free() >= 7U) {
+        uart.write(0xF0U);
+        uart.write(SYSEX_MANUFACTURER_ID);
+        uart.write(SYSEX_DEVICE_ID);
+        uart.write(SYSEX_CMD_ACK);
+        uart.write(ack_command);
+        uart.write(ack_status);
+        uart.write(0xF7U);
+        ack_pending = false;
+    }
+
+    // Calibration dump or performance counters
+    while (tx_state != SysExTxState::IDLE && uart.tx_free()) {
+        switch (tx_state) {
+        case SysExTxState::HEADER:
+            if (tx_pos == 0U)
+                uart.write(0xF0U);
+            else if (tx_pos == 1U)
+                uart.write(SYSEX_MANUFACTURER_ID);
+            else if (tx_pos == 2U)
+                uart.write(SYSEX_DEVICE_ID);
+            else {
+                uart.write(tx_command);
+                tx_state = SysExTxState::DATA;
+                tx_index = 0U;
+                tx_checksum = 0U;
+                tx_pos = 0U;
+                break;
+            }
+            tx_pos++;
+            break;
+
+        case SysExTxState::DATA:
+            uart.write(transmit_data());
+            break;
+
+        case SysExTxState::CHECKSUM:
+            uart.write(tx_pos ? tx_checksum & 0x7FU : (tx_checksum >> 7U) & 0x7FU);
+            if (tx_pos++)
+                tx_state = SysExTxState::END;
+            break;
+
+        default:
+            uart.write(0xF7U);
+            tx_state = SysExTxState::IDLE;
+            break;
+        }
+    }
+}
@@ -0,0 +1,173 @@
+/**
+ * @file timebase.cpp
+ * @author Fern Lane
+ * @brief Free-running Timer1 -based high resolution timestamps
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "include/timebase.h"
+
+#include <util/atomic.h>
+
+// Preinstantiate
+Timebase timebase;
+
+/**
+ * @brief Timer1 compare unit of alarm
+ *
+ * @param alarm TIMEBASE_ALARM_CLOCK (compare B) or TIMEBASE_ALARM_PLAYOUT (compare A)
+ * @return uint8_t compare interrupt enable bit mask (OCF1x flags are at the same positions in TIFR1)
+ */
+static inline uint8_t compare_mask(uint8_t alarm) {
+    return alarm == TIMEBASE_ALARM_PLAYOUT ? _BV(OCIE1A) : _BV(OCIE1B);
+}
+
+/**
+ * @brief Starts Timer1 in normal (free-running) mode with /8 prescaler and enables overflow interrupt.
+ * NOTE: This overrides Arduino's default PWM setup of Timer1, so analogWrite() on pins 9 and 10 will not work
+ */
+void Timebase::init(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TCCR1A = 0U;
+        TCCR1B = _BV(CS11);
+        TCNT1 = 0U;
+        overflows = 0U;
+        alarms_pending = 0U;
+        TIFR1 = _BV(TOV1);
+        TIMSK1 = (TIMSK1 & ~(_BV(OCIE1A) | _BV(OCIE1B))) | _BV(TOIE1);
+    }
+}
+
+/**
+ * @brief Reads current timestamp. Safe to call from both interrupts and main loop
+ *
+ * @return uint32_t time in Timer1 ticks (see TIMEBASE_TICKS_PER_US)
+ */
+uint32_t Timebase::now(void) {
+    uint16_t ticks, overflows_;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ticks = TCNT1;
+        overflows_ = overflows;
+
+        // Timer overflowed, but interrupt was not handled yet
+        if ((TIFR1 & _BV(TOV1)) && ticks < 0x8000U)
+            overflows_++;
+    }
+    return (static_cast<uint32_t>(overflows_) << 16U) | ticks;
+}
+
+/**
+ * @brief Sets one-shot alarm. Only one alarm of each kind can be active, new one replaces previous.
+ * Safe to call from interrupts
+ *
+ * @param alarm TIMEBASE_ALARM_CLOCK or TIMEBASE_ALARM_PLAYOUT
+ * @param time when to call `callback` (see `now()`). Must be in the future (less than 2^31 ticks ahead)
+ * @param callback function to call from interrupt
+ */
+void Timebase::set_alarm(uint8_t alarm, uint32_t time, void (*callback)(void)) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TIMSK1 &= ~compare_mask(alarm);
+        alarm_time[alarm] = time;
+        alarm_callback[alarm] = callback;
+        alarms_pending |= _BV(alarm);
+        arm_alarm(alarm);
+    }
+}
+
+/**
+ * @brief Cancels pending alarm (if any). Safe to call from interrupts
+ *
+ * @param alarm TIMEBASE_ALARM_CLOCK or TIMEBASE_ALARM_PLAYOUT
+ */
+void Timebase::cancel_alarm(uint8_t alarm) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TIMSK1 &= ~compare_mask(alarm);
+        alarms_pending &= ~_BV(alarm);
+    }
+}
+
+/**
+ * @brief Arms Timer1 compare if alarm is within current 16-bit timer period or fires it if it's too close.
+ * Otherwise, it will be re-checked on the next overflow.
+ * NOTE: Must be called with interrupts disabled
+ *
+ * @param alarm TIMEBASE_ALARM_CLOCK or TIMEBASE_ALARM_PLAYOUT
+ */
+void Timebase::arm_alarm(uint8_t alarm) {
+    int32_t delta = static_cast<int32_t>(alarm_time[alarm] - now());
+
+    // Too close (or already late) -> fire right now
+    if (delta < TIMEBASE_ALARM_MIN_TICKS) {
+        alarms_pending &= ~_BV(alarm);
+        alarm_callback[alarm]();
+        return;
+    }
+
+    // Compare will match exactly at alarm_time only if it's less than 1 timer period ahead
+    if (delta < 0x10000L) {
+        if (alarm == TIMEBASE_ALARM_PLAYOUT)
+            OCR1A = static_cast<uint16_t>(alarm_time[alarm]);
+        else
+            OCR1B = static_cast<uint16_t>(alarm_time[alarm]);
+        TIFR1 = compare_mask(alarm);
+        TIMSK1 |= compare_mask(alarm);
+    }
+}
+
+/**
+ * @brief Counts Timer1 overflows (upper 16 bits of timestamp) and arms distant alarms
+ */
+void Timebase::handle_overflow(void) {
+    overflows++;
+    for (uint8_t alarm = 0U; alarm < TIMEBASE_ALARMS; ++alarm)
+        if ((alarms_pending & _BV(alarm)) && !(TIMSK1 & compare_mask(alarm)))
+            arm_alarm(alarm);
+}
+
+/**
+ * @brief Fires armed alarm
+ *
+ * @param alarm TIMEBASE_ALARM_CLOCK or TIMEBASE_ALARM_PLAYOUT
+ */
+void Timebase::handle_compare(uint8_t alarm) {
+    TIMSK1 &= ~compare_mask(alarm);
+    if (!(alarms_pending & _BV(alarm)))
+        return;
+    alarms_pending &= ~_BV(alarm);
+    alarm_callback[alarm]();
+}
+
+/**
+ * @brief Timer1 overflow interrupt (wrapper for `handle_overflow()`)
+ */
+ISR(TIMER1_OVF_vect) { timebase.handle_overflow(); }
+
+/**
+ * @brief Timer1 compare A interrupt (wrapper for `handle_compare()`)
+ */
+ISR(TIMER1_COMPA_vect) { timebase.handle_compare(TIMEBASE_ALARM_PLAYOUT); }
+
+/**
+ * @brief Timer1 compare B interrupt (wrapper for `handle_compare()`)
+ */
+ISR(TIMER1_COMPB_vect) { timebase.handle_compare(TIMEBASE_ALARM_CLOCK); }
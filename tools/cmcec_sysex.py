@@ -0,0 +1,367 @@
+#!/usr/bin/env python3
+"""
+Copyright (c) 2022-2025 Fern Lane
+
+This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+See the License for the specific language governing permissions and
+limitations under the License.
+
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+Calibration backup / restore, stacking and performance counters over SysEx (see docs/SYSEX.md)
+
+Usage:
+    cmcec_sysex.py dump PORT FILE.syx       # Read calibration from CMCEC and save it
+    cmcec_sysex.py restore PORT FILE.syx    # Write saved calibration into CMCEC
+    cmcec_sysex.py show FILE.syx            # Print saved calibration
+    cmcec_sysex.py unit PORT INDEX COUNT    # Set index of this unit in stack of COUNT units
+    cmcec_sysex.py perf PORT [--reset]      # Read (and reset) performance counters
+    cmcec_sysex.py flood PORT [--rate N] [--seconds S]  # Main loop period without MIDI input vs under pitch bends
+
+PORT is a raw MIDI device (ex. /dev/snd/midiC1D0 or /dev/midi1) or a serial port connected directly to CMCEC's
+MIDI IN / OUT (ex. /dev/ttyUSB0, must be already configured to 31250 Bps)
+"""
+
+import argparse
+import math
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+
+# Must be the same as in "include/sysex.h" and "include/calibration.h"
+MANUFACTURER_ID = 0x7D
+DEVICE_ID = 0x43
+CMD_CALIB_REQUEST = 0x01
+CMD_CALIB_DATA = 0x02
+CMD_SET_UNIT = 0x03
+CMD_PERF_REQUEST = 0x04
+CMD_PERF_DATA = 0x05
+CMD_ACK = 0x7F
+ACK_STATUSES = {0x00: "OK", 0x01: "wrong length", 0x02: "wrong checksum", 0x03: "aborted", 0x04: "out of range"}
+UNITS_MAX = 4
+PACK_GROUP = 7
+MATRIX_NOTES = 128 - 12
+MATRIX_SIZE = 2 + 2 * MATRIX_NOTES
+BACKUP_SIZE = 2 + 2 * MATRIX_SIZE
+
+# Must be the same as `perfCounters` in "include/perf.h"
+PERF_VERSION = 4
+PERF_FORMAT = "<BIHHHHHHIIHHIIHH"
+PERF_SIZE = struct.calcsize(PERF_FORMAT)
+PERF_FIELDS = (
+    ("rx_bytes", "MIDI bytes received"),
+    ("rx_overruns", "USART data overruns"),
+    ("rx_dropped", "Bytes dropped (receive buffer full)"),
+    ("parse_errors", "Parse errors"),
+    ("events_dropped", "Note events dropped"),
+    ("loop_max", "Max loop period (us)"),
+    ("loop_avg", "Average loop period (us)"),
+    ("clock_in", "MIDI clock ticks received"),
+    ("clock_out", "Clock pulses emitted"),
+    ("late_events", "Late playout events"),
+    ("late_max", "Max playout lateness (us)"),
+    ("dac_latched", "DAC registers latched"),
+    ("dac_skipped", "DAC register writes skipped"),
+    ("dac_isr_max", "Max DAC engine interrupt (cycles)"),
+    ("dac_isr_load", "DAC engine CPU load (0.01%)"),
+)
+
+# Max and average cycles of each probe are appended if CMCEC is built with PERF_PROBES (bit 7 of version is set).
+# Must be the same as `PerfProbe` in "include/perf.h"
+PERF_VERSION_PROBES = 0x80
+PERF_PROBES = (
+    ("parse_byte", "MIDI byte parse"),
+    ("note_scan", "Next note scan"),
+    ("cv_update", "Bends and CV update"),
+    ("dac_output", "Full DAC update"),
+)
+
+# Time to wait for reply (restore includes EEPROM write)
+TIMEOUT = 5.0
+
+# Pitch bend flood: sweep amplitude (of 8192) and period (messages per sine period)
+FLOOD_DEPTH = 4000
+FLOOD_PERIOD = 600
+
+
+def pack(data: bytes) -> bytes:
+    """Encodes 8-bit data into 7-bit groups (each group starts with MSBs of up to 7 following bytes)"""
+    packed = bytearray()
+    for i in range(0, len(data), PACK_GROUP):
+        group = data[i : i + PACK_GROUP]
+        packed.append(sum(((byte >> 7) & 1) << j for j, byte in enumerate(group)))
+        packed.extend(byte & 0x7F for byte in group)
+    return bytes(packed)
+
+
+def unpack(packed: bytes, size: int) -> bytes:
+    """Decodes `size` bytes from 7-bit groups"""
+    data = bytearray()
+    position = 0
+    while len(data) < size:
+        msbs = packed[position]
+        position += 1
+        for j in range(min(PACK_GROUP, size - len(data))):
+            data.append(packed[position] | (((msbs >> j) & 1) << 7))
+            position += 1
+    return bytes(data)
+
+
+def checksum(data: bytes) -> bytes:
+    value = sum(data) & 0x3FFF
+    return bytes(((value >> 7) & 0x7F, value & 0x7F))
+
+
+def build_message(command: int, payload: bytes = b"") -> bytes:
+    return bytes((0xF0, MANUFACTURER_ID, DEVICE_ID, command)) + payload + b"\xF7"
+
+
+def build_calib_data(image: bytes) -> bytes:
+    return build_message(CMD_CALIB_DATA, pack(image) + checksum(image))
+
+
+def packed_length(size: int) -> int:
+    """Length of `size` bytes encoded by `pack()`"""
+    return size + (size + PACK_GROUP - 1) // PACK_GROUP
+
+
+def parse_data(message: bytes, command: int, size: int) -> bytes:
+    """Checks data message (packed data and checksum) and returns decoded data"""
+    if message[:4] != bytes((0xF0, MANUFACTURER_ID, DEVICE_ID, command)) or message[-1] != 0xF7:
+        raise ValueError(f"Not a CMCEC {command:02X} message")
+    payload = message[4:-1]
+    packed_size = packed_length(size)
+    if len(payload) != packed_size + 2:
+        raise ValueError(f"Wrong message length: {len(payload)} instead of {packed_size + 2}")
+    data = unpack(payload, size)
+    if checksum(data) != payload[-2:]:
+        raise ValueError("Wrong message checksum")
+    return data
+
+
+def parse_calib_data(message: bytes) -> bytes:
+    """Checks calibration dump message and returns decoded backup image"""
+    return parse_data(message, CMD_CALIB_DATA, BACKUP_SIZE)
+
+
+def parse_perf_data(message: bytes) -> dict:
+    """Checks performance counters message and returns counters by name (and `(max, avg)` of each appended probe)"""
+    # Number of appended probes from message length (4 bytes each)
+    probes_n = 0
+    while probes_n < len(PERF_PROBES) and packed_length(PERF_SIZE + 4 * probes_n) + 7 < len(message):
+        probes_n += 1
+    data = parse_data(message, CMD_PERF_DATA, PERF_SIZE + 4 * probes_n)
+    values = struct.unpack(PERF_FORMAT, data[:PERF_SIZE])
+    if values[0] & ~PERF_VERSION_PROBES != PERF_VERSION or bool(values[0] & PERF_VERSION_PROBES) != bool(probes_n):
+        raise ValueError(f"Unsupported counters version: {values[0]}")
+    counters = {name: value for (name, _), value in zip(PERF_FIELDS, values[1:])}
+    probes = struct.unpack(f"<{2 * probes_n}H", data[PERF_SIZE:])
+    for i, (name, _) in enumerate(PERF_PROBES[:probes_n]):
+        counters[name] = (probes[i], probes[probes_n + i])
+    return counters
+
+
+class Port:
+    """Raw MIDI device or serial port"""
+
+    def __init__(self, path: str) -> None:
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        self.attributes = None
+        if os.isatty(self.fd):
+            self.attributes = termios.tcgetattr(self.fd)
+            tty.setraw(self.fd)
+
+    def close(self) -> None:
+        if self.attributes is not None:
+            termios.tcsetattr(self.fd, termios.TCSADRAIN, self.attributes)
+        os.close(self.fd)
+
+    def write(self, data: bytes) -> None:
+        while data:
+            data = data[os.write(self.fd, data) :]
+        if self.attributes is not None:
+            termios.tcdrain(self.fd)
+
+    def read_message(self, command: int, timeout: float = TIMEOUT) -> bytes:
+        """Reads bytes until CMCEC SysEx message with specified command is received"""
+        header = bytes((0xF0, MANUFACTURER_ID, DEVICE_ID, command))
+        message = bytearray()
+        deadline = time.monotonic() + timeout
+        while True:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0 or not select.select([self.fd], [], [], remaining)[0]:
+                raise TimeoutError("No reply from CMCEC")
+            for byte in os.read(self.fd, 1024):
+                # Real-time messages can appear anywhere
+                if byte >= 0xF8:
+                    continue
+                if byte == 0xF0:
+                    message = bytearray((byte,))
+                elif message:
+                    message.append(byte)
+                    if byte & 0x80 and byte != 0xF7:
+                        message = bytearray()
+                    elif byte == 0xF7:
+                        if message.startswith(header):
+                            return bytes(message)
+                        message = bytearray()
+
+
+def dump(port: Port, file: str) -> None:
+    port.write(build_message(CMD_CALIB_REQUEST))
+    message = port.read_message(CMD_CALIB_DATA)
+    parse_calib_data(message)
+    with open(file, "wb") as syx:
+        syx.write(message)
+    print(f"Saved {len(message)} bytes into {file}")
+
+
+def restore(port: Port, file: str) -> None:
+    with open(file, "rb") as syx:
+        message = syx.read()
+    parse_calib_data(message)
+    port.write(message)
+    ack = port.read_message(CMD_ACK)
+    status = ack[5] if len(ack) > 6 else None
+    print(f"Restore result: {ACK_STATUSES.get(status, 'unknown')}")
+    if status != 0x00:
+        sys.exit(1)
+
+
+def set_unit(port: Port, index: int, count: int) -> None:
+    if not 1 <= count <= UNITS_MAX or not 0 <= index < count:
+        raise ValueError(f"Index must be 0-{count - 1} and number of units 1-{UNITS_MAX}")
+    port.write(build_message(CMD_SET_UNIT, bytes((index, count))))
+    ack = port.read_message(CMD_ACK)
+    status = ack[5] if len(ack) > 6 else None
+    print(f"Set unit result: {ACK_STATUSES.get(status, 'unknown')}")
+    if status != 0x00:
+        sys.exit(1)
+
+
+def perf(port: Port, reset: bool) -> None:
+    port.write(build_message(CMD_PERF_REQUEST, b"\x01" if reset else b""))
+    counters = parse_perf_data(port.read_message(CMD_PERF_DATA))
+    for name, description in PERF_FIELDS:
+        print(f"{description + ':':40}{counters[name]}")
+    for name, description in PERF_PROBES:
+        if name in counters:
+            print(f"{description + ' max / avg (cycles):':40}{counters[name][0]} / {counters[name][1]}")
+
+
+def flood(port: Port, rate: int, seconds: float) -> None:
+    """Measures main loop period (`loop_avg` / `loop_max` counters) without MIDI input and under a flood of pitch
+    bends on the 1st MIDI channel (sine sweep, `rate` messages per second)"""
+    results = []
+    for bends in (False, True):
+        port.write(build_message(CMD_PERF_REQUEST, b"\x01"))
+        port.read_message(CMD_PERF_DATA)
+
+        # Send bends in 10ms chunks
+        start = time.monotonic()
+        sent = 0
+        while time.monotonic() - start < seconds:
+            if bends:
+                due = int((time.monotonic() - start) * rate)
+                chunk = bytearray()
+                for i in range(sent, due):
+                    value = 8192 + int(FLOOD_DEPTH * math.sin(2.0 * math.pi * i / FLOOD_PERIOD))
+                    chunk.extend((0xE0, value & 0x7F, value >> 7))
+                port.write(bytes(chunk))
+                sent = due
+            time.sleep(0.01)
+        if bends:
+            port.write(bytes((0xE0, 0x00, 0x40)))
+
+        port.write(build_message(CMD_PERF_REQUEST))
+        results.append((sent / seconds, parse_perf_data(port.read_message(CMD_PERF_DATA))))
+
+    for rate_sent, counters in results:
+        print(
+            f"{rate_sent:7.1f} bends/s: loop avg {counters['loop_avg']}us, max {counters['loop_max']}us, "
+            f"{counters['rx_bytes']} bytes received, {counters['rx_dropped']} dropped, "
+            f"{counters['rx_overruns']} overruns"
+        )
+
+
+def show(file: str) -> None:
+    with open(file, "rb") as syx:
+        image = parse_calib_data(syx.read())
+    for channel in range(2):
+        gain = image[channel]
+        offset = (gain & 0x7F) / (1e3 if gain & 0x80 else -1e3)
+        matrix = image[2 + channel * MATRIX_SIZE : 2 + (channel + 1) * MATRIX_SIZE]
+        note_min, note_max = matrix[0], matrix[1]
+        print(f"--- CHANNEL {channel + 1} ---")
+        print(f"Gain offset: {offset:+.3f} (raw: 0x{gain:02X})")
+        if note_min > 127 or note_max > 127 or note_min == 0 or note_min >= note_max:
+            print("No VCO calibration")
+            continue
+        print(f"Notes: {note_min}-{note_max}")
+        print("Note,Target voltage (mv)")
+        mvs = struct.unpack(f"<{MATRIX_NOTES}H", matrix[2:])
+        for note in range(note_min, note_max + 1):
+            print(f"{note},{mvs[note - 12]}")
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description="CMCEC calibration backup / restore over SysEx")
+    subparsers = parser.add_subparsers(dest="command", required=True)
+    for command in ("dump", "restore"):
+        subparser = subparsers.add_parser(command)
+        subparser.add_argument("port", help="raw MIDI device or serial port")
+        subparser.add_argument("file", help=".syx file")
+    subparsers.add_parser("show").add_argument("file", help=".syx file")
+    subparser = subparsers.add_parser("unit")
+    subparser.add_argument("port", help="raw MIDI device or serial port")
+    subparser.add_argument("index", type=int, help="index of this unit (starting from 0)")
+    subparser.add_argument("count", type=int, help="number of stacked units")
+    subparser = subparsers.add_parser("perf")
+    subparser.add_argument("port", help="raw MIDI device or serial port")
+    subparser.add_argument("--reset", action="store_true", help="reset counters after reading them")
+    subparser = subparsers.add_parser("flood")
+    subparser.add_argument("port", help="raw MIDI device or serial port")
+    subparser.add_argument("--rate", type=int, default=1000, help="pitch bends per second (default: 1000)")
+    subparser.add_argument("--seconds", type=float, default=5.0, help="duration of each measurement (default: 5)")
+    args = parser.parse_args()
+
+    try:
+        if args.command == "show":
+            show(args.file)
+            return
+        port = Port(args.port)
+        try:
+            if args.command == "unit":
+                set_unit(port, args.index, args.count)
+            elif args.command == "perf":
+                perf(port, args.reset)
+            elif args.command == "flood":
+                flood(port, args.rate, args.seconds)
+            else:
+                (dump if args.command == "dump" else restore)(port, args.file)
+        finally:
+            port.close()
+    except (OSError, ValueError, TimeoutError) as e:
+        print(f"Error: {e}", file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,297 @@
+#!/usr/bin/env python3
+"""
+Copyright (c) 2022-2025 Fern Lane
+
+This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+See the License for the specific language governing permissions and
+limitations under the License.
+
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+Linux bridge for high speed serial MIDI transport (see MIDI_SERIAL_BAUD in "include/midi.h" and docs/MANUAL.md).
+Streams Standard MIDI File or raw MIDI bytes into CMCEC's serial port at any baud rate. No dependencies
+
+Usage:
+    midi_bridge.py play FILE.mid DEVICE [--baud BAUD]    # Play Standard MIDI File (format 0 or 1) in real time
+    midi_bridge.py raw SOURCE DEVICE [--baud BAUD]       # Forward raw MIDI bytes as soon as they arrive
+
+DEVICE is a serial port (ex. /dev/ttyUSB0) or "pty" to create pseudo-terminal and print it's path (ex. to connect
+AVR simulator's UART to it). SOURCE is a raw MIDI device (ex. /dev/snd/midiC1D0), named pipe, pty, "-" for stdin or
+"pty" to create pseudo-terminal to write MIDI bytes into.
+
+Bursts are limited to --burst bytes and then paced to --rate bytes per second, so CMCEC's receive buffer
+(UART_RX_BUFFER_SIZE in "include/uart.h") doesn't overflow
+"""
+
+import argparse
+import array
+import fcntl
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+
+# Set the same MIDI_SERIAL_BAUD in "include/midi.h"
+BAUD_DEFAULT = 250000
+BAUD_DIN = 31250
+
+# Burst size (less than UART_RX_BUFFER_SIZE for high speed transport) and average rate limit
+BURST_DEFAULT = 24
+RATE_DEFAULT = 20000
+
+# Linux termios2 (arbitrary baud rates)
+TCGETS2 = 0x802C542A
+TCSETS2 = 0x402C542B
+CBAUD = 0o010017
+BOTHER = 0o010000
+TERMIOS2_FORMAT = "IIIIB19BII"
+
+
+def set_baud(fd: int, baud: int) -> None:
+    """Sets raw mode and any baud rate (using termios2)"""
+    tty.setraw(fd)
+    buffer = array.array("B", bytes(struct.calcsize(TERMIOS2_FORMAT)))
+    fcntl.ioctl(fd, TCGETS2, buffer, True)
+    fields = list(struct.unpack(TERMIOS2_FORMAT, buffer.tobytes()))
+    fields[2] = (fields[2] & ~CBAUD) | BOTHER
+    fields[-2] = baud
+    fields[-1] = baud
+    fcntl.ioctl(fd, TCSETS2, struct.pack(TERMIOS2_FORMAT, *fields))
+
+
+def open_pty(name: str) -> int:
+    """Creates pseudo-terminal in raw mode and prints it's path"""
+    master, slave = os.openpty()
+    tty.setraw(master)
+    tty.setraw(slave)
+    print(f"{name}: {os.ttyname(slave)}", file=sys.stderr)
+    return master
+
+
+def read_vlq(data: bytes, position: int) -> tuple:
+    """Reads variable-length quantity. Returns value and new position"""
+    value = 0
+    while True:
+        byte = data[position]
+        position += 1
+        value = (value << 7) | (byte & 0x7F)
+        if not byte & 0x80:
+            return value, position
+
+
+def read_smf(file: str) -> list:
+    """Reads Standard MIDI File into list of (time in seconds, message bytes) sorted by time"""
+    with open(file, "rb") as smf:
+        data = smf.read()
+    if data[:4] != b"MThd":
+        raise ValueError("Not a Standard MIDI File")
+    header_length = struct.unpack(">I", data[4:8])[0]
+    _, tracks_n, division = struct.unpack(">HHH", data[8:14])
+    if division & 0x8000:
+        raise ValueError("SMPTE time division is not supported")
+
+    # (tick, order, message) and tempo changes (tick, us per quarter note)
+    events = []
+    tempos = []
+    position = 8 + header_length
+    for track in range(tracks_n):
+        if data[position : position + 4] != b"MTrk":
+            raise ValueError(f"Track {track} not found")
+        end = position + 8 + struct.unpack(">I", data[position + 4 : position + 8])[0]
+        position += 8
+        tick = 0
+        status = 0
+        while position < end:
+            delta, position = read_vlq(data, position)
+            tick += delta
+            byte = data[position]
+
+            # Meta event (only tempo is used)
+            if byte == 0xFF:
+                meta_type = data[position + 1]
+                length, position = read_vlq(data, position + 2)
+                if meta_type == 0x51:
+                    tempos.append((tick, int.from_bytes(data[position : position + 3], "big")))
+                position += length
+                continue
+
+            # SysEx (F7 - escape or continuation, sent as is)
+            if byte in (0xF0, 0xF7):
+                length, position = read_vlq(data, position + 1)
+                message = data[position : position + length]
+                events.append((tick, len(events), (b"\xF0" if byte == 0xF0 else b"") + message))
+                position += length
+                continue
+
+            # Channel messages (with running status)
+            if byte & 0x80:
+                status = byte
+                position += 1
+            length = 1 if 0xC0 <= status < 0xE0 else 2
+            events.append((tick, len(events), bytes((status,)) + data[position : position + length]))
+            position += length
+        position = end
+
+    # Ticks -> seconds using tempo map
+    events.sort()
+    tempos.sort()
+    result = []
+    tempo_index = 0
+    tempo_tick = 0
+    tempo_time = 0.0
+    tempo = 500000
+    for tick, _, message in events:
+        while tempo_index < len(tempos) and tempos[tempo_index][0] <= tick:
+            tempo_time += (tempos[tempo_index][0] - tempo_tick) * tempo / division / 1e6
+            tempo_tick, tempo = tempos[tempo_index]
+            tempo_index += 1
+        result.append((tempo_time + (tick - tempo_tick) * tempo / division / 1e6, message))
+    return result
+
+
+class Output:
+    """Serial port (or pty) writer with running status and burst / rate limiting"""
+
+    def __init__(self, device: str, baud: int, burst: int, rate: int) -> None:
+        if device == "pty":
+            self.fd = open_pty("Output")
+        else:
+            self.fd = os.open(device, os.O_RDWR | os.O_NOCTTY)
+            set_baud(self.fd, baud)
+        self.baud = baud
+        self.burst = burst
+        self.rate = rate
+        self.tokens = float(burst)
+        self.tokens_time = time.monotonic()
+        self.status = 0
+        self.bytes_n = 0
+        self.delay_max = 0.0
+
+    def close(self) -> None:
+        # All notes off
+        self.status = 0
+        for channel in range(16):
+            self.write_message(bytes((0xB0 | channel, 123, 0)))
+        os.close(self.fd)
+
+    def write_message(self, message: bytes) -> None:
+        """Sends one message (omits status byte if it's the same as previous one)"""
+        if 0x80 <= message[0] < 0xF0 and message[0] == self.status:
+            message = message[1:]
+        elif 0x80 <= message[0] < 0xF8:
+            self.status = message[0] if message[0] < 0xF0 else 0
+        self.write(message)
+
+    def write(self, data: bytes) -> None:
+        start = time.monotonic()
+        while data:
+            # Wait for tokens (burst then rate)
+            now = time.monotonic()
+            self.tokens = min(self.burst, self.tokens + (now - self.tokens_time) * self.rate)
+            self.tokens_time = now
+            if self.tokens < 1.0:
+                time.sleep((1.0 - self.tokens) / self.rate)
+                continue
+            chunk = data[: int(self.tokens)]
+            written = os.write(self.fd, chunk)
+            self.tokens -= written
+            self.bytes_n += written
+            data = data[written:]
+        self.delay_max = max(self.delay_max, time.monotonic() - start)
+
+    def print_stats(self) -> None:
+        wire = self.bytes_n * 10 / self.baud
+        wire_din = self.bytes_n * 10 / BAUD_DIN
+        print(
+            f"{self.bytes_n} bytes sent. Wire time {wire * 1e3:.1f}ms "
+            f"({wire_din * 1e3:.1f}ms @ {BAUD_DIN} Bps). Max pacing delay {self.delay_max * 1e3:.2f}ms",
+            file=sys.stderr,
+        )
+
+
+def play(output: Output, file: str) -> None:
+    events = read_smf(file)
+    print(f"Playing {len(events)} events ({events[-1][0] if events else 0:.1f}s)", file=sys.stderr)
+    start = time.monotonic()
+    for event_time, message in events:
+        delay = start + event_time - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+        output.write_message(message)
+
+
+def forward(output: Output, source: str) -> None:
+    if source == "-":
+        fd = sys.stdin.fileno()
+    elif source == "pty":
+        fd = open_pty("Input")
+    else:
+        fd = os.open(source, os.O_RDONLY | os.O_NOCTTY)
+    if os.isatty(fd):
+        tty.setraw(fd)
+
+    # Bytes are forwarded as is (no need to know message boundaries)
+    while True:
+        select.select([fd], [], [])
+        try:
+            data = os.read(fd, 1024)
+        except OSError:
+            data = b""
+        if not data:
+            # Writer of pty / pipe closed it -> wait for the next one
+            if source == "pty":
+                time.sleep(0.1)
+                continue
+            return
+        output.write(data)
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description="High speed serial MIDI bridge for CMCEC")
+    subparsers = parser.add_subparsers(dest="command", required=True)
+    subparser = subparsers.add_parser("play", help="play Standard MIDI File")
+    subparser.add_argument("file", help=".mid file")
+    subparser_raw = subparsers.add_parser("raw", help="forward raw MIDI bytes")
+    subparser_raw.add_argument("source", help='raw MIDI device, pipe, pty, "-" (stdin) or "pty" (create)')
+    for subparser in (subparser, subparser_raw):
+        subparser.add_argument("device", help='CMCEC serial port or "pty" (create)')
+        subparser.add_argument("--baud", type=int, default=BAUD_DEFAULT, help=f"default: {BAUD_DEFAULT}")
+        subparser.add_argument("--burst", type=int, default=BURST_DEFAULT, help=f"default: {BURST_DEFAULT} bytes")
+        subparser.add_argument("--rate", type=int, default=RATE_DEFAULT, help=f"default: {RATE_DEFAULT} bytes/s")
+    args = parser.parse_args()
+
+    try:
+        output = Output(args.device, args.baud, max(args.burst, 1), max(args.rate, 1))
+        try:
+            if args.command == "play":
+                play(output, args.file)
+            else:
+                forward(output, args.source)
+        except KeyboardInterrupt:
+            pass
+        finally:
+            output.close()
+            output.print_stats()
+    except (OSError, ValueError) as e:
+        print(f"Error: {e}", file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+"""
+Copyright (c) 2022-2025 Fern Lane
+
+This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+See the License for the specific language governing permissions and
+limitations under the License.
+
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+Host-side model of VCC compensation (`DAC::calculate_compensation()` and `VCC` in "include/vcc.h"). No dependencies:
+- Compares previous soft-float path (float32, emulated bit-exactly) with fixed-point scale path for every Q14.2 mV
+  target over VCC 4.0-6.0V and gain calibrations
+- Simulates DAC code stability with noisy VCC measurement: single blocking conversion per loop (previous) vs
+  oversampled, decimated and averaged measurement with sub-LSB hysteresis (synthetic gaussian ADC noise, not a
+  hardware measurement)
+
+Usage:
+    model_compensation.py [--full]    # --full checks every gain calibration DIP state (slower)
+    model_compensation.py --stability [--noise LSB]
+
+Main loop time: previous path waited for ADC conversion (13 ADC clocks @ 125kHz = 104us) on every loop. Now ADC is
+auto-triggered by Timer0 overflow and it's interrupt costs ~976 x ~70 cycles per second (~0.4% CPU). Check
+`loop_avg` / `loop_max` performance counters (`cmcec_sysex.py perf`) to measure it on hardware
+
+Estimated cost per call on ATmega328 (ADC conversion excluded; from typical avr-libc / libgcc routine costs, not
+measured on hardware):
+    float path: 1 division for VCC, then per DAC 2 multiplications, 1 division, 2 additions and 2 conversions
+                -> ~2900 cycles (~180us @ 16MHz)
+    fixed path: 2 float comparisons (gain calibration check), then per DAC one 16x16->32 multiplication and shift
+                -> ~150 cycles (~10us @ 16MHz), ~100 more when VCC reading changes
+"""
+
+import argparse
+import array
+import operator
+import random
+
+# Same as in "include/dac.h", "include/vcc.h" and "include/calibration.h"
+DAC_MAX = 4095
+DAC_SCALE_SHIFT = 16
+DAC_GAIN_SHIFT = 12
+VCC_SAMPLES_SHIFT = 6
+VCC_FRACTION_BITS = 4
+VCC_IIR_SHIFT = 2
+VCC_HYSTERESIS = 8
+MV_Q2_ONE = 4
+INTERNAL_VREF_MV = 1100.0
+GAIN_BASE = 1.824
+
+# 6.0V - 4.0V (VCC = 1100 * 1023 / raw)
+VCC_RAW_RANGE = range(188, 282)
+
+# Gain calibration DIP states: 0, min, max and a few in between (see `dip_to_gain_offset()`)
+DIP_STATES = (0x00, 0x7F, 0xFF, 0x01, 0x81, 0x40, 0xC0, 0x33, 0xB3)
+
+TARGETS = range(0, 0x10000)
+
+
+def f32(x: float) -> float:
+    """Rounds to float32 (AVR's float and double)"""
+    return array.array("f", (x,))[0]
+
+
+def dip_to_gain(dip: int) -> float:
+    """GAIN_x_BASE + `dip_to_gain_offset()` in float32"""
+    offset = f32(float(dip & 0x7F) / (1e3 if dip & 0x80 else -1e3))
+    return f32(f32(GAIN_BASE) + offset)
+
+
+def float_codes(vcc_raw: int, gain: float) -> list:
+    """Previous path: vcc = 1100 * 1023 / raw, code = map_f(target / 4, 0, vcc * gain, 0, DAC_MAX)"""
+    vcc = f32(INTERNAL_VREF_MV * 1023.0 / vcc_raw)
+    full = f32(vcc * gain)
+
+    # float32 x float32 and float32 / float32 in double are exact / correctly rounded before rounding to float32
+    products = array.array("f", (target / MV_Q2_ONE * DAC_MAX for target in TARGETS))
+    codes = array.array("f", (product / full for product in products))
+    return [min(int(code), DAC_MAX) for code in codes]
+
+
+def fixed_scale(vcc_filtered: int, gain: float) -> int:
+    """Gain factor (float32, only on calibration change) and scale (on VCC change). vcc_filtered is Q10.4"""
+    factor = f32(DAC_MAX / f32(MV_Q2_ONE * INTERNAL_VREF_MV * 1023.0 * gain))
+    factor = int(f32(factor * (1 << (DAC_SCALE_SHIFT + DAC_GAIN_SHIFT)) + 0.5))
+    vcc_shift = DAC_GAIN_SHIFT + VCC_FRACTION_BITS
+    assert vcc_filtered * factor < 1 << 32, "VCC x gain factor doesn't fit into uint32_t"
+    scale = (vcc_filtered * factor + (1 << (vcc_shift - 1))) >> vcc_shift
+    assert scale < 0x10000, "Scale doesn't fit into uint16_t"
+    return scale
+
+
+def fixed_codes(vcc_raw: int, gain: float) -> list:
+    """New path: one multiplication per target"""
+    scale = fixed_scale(vcc_raw << VCC_FRACTION_BITS, gain)
+    return [min((target * scale) >> DAC_SCALE_SHIFT, DAC_MAX) for target in TARGETS]
+
+
+def stability(noise: float) -> None:
+    """DAC code of constant target (C4 = 4V) over 60s with noisy VCC measurement and slow VCC drift"""
+    rng = random.Random(1)
+    gain = dip_to_gain(0)
+    target = 4000 * MV_Q2_ONE
+    duration = 60.0
+
+    def vcc_raw_exact(time: float) -> float:
+        # 5.0V drifting down to 4.95V over the last half
+        vcc = 5000.0 - 50.0 * max(time - duration / 2, 0.0) / (duration / 2)
+        return INTERNAL_VREF_MV * 1023.0 / vcc
+
+    def sample(time: float) -> int:
+        return min(max(int(round(vcc_raw_exact(time) + rng.gauss(0.0, noise))), 0), 1023)
+
+    def exact_code(time: float) -> float:
+        return target * vcc_raw_exact(time) * DAC_MAX / (MV_Q2_ONE * INTERNAL_VREF_MV * 1023.0 * gain)
+
+    # Previous path: one conversion per main loop (~1ms)
+    loop_period = 0.001
+    previous = []
+    for i in range(int(duration / loop_period)):
+        time = i * loop_period
+        scale = fixed_scale(sample(time) << VCC_FRACTION_BITS, gain)
+        previous.append((time, (target * scale) >> DAC_SCALE_SHIFT))
+
+    # New path: conversion on every Timer0 overflow, decimation, IIR average and hysteresis (same as
+    # `VCC::handle_conversion()`)
+    adc_period = 64.0 * 256.0 / 16e6
+    new = []
+    filtered = total = samples = average = 0
+    for i in range(int(duration / adc_period)):
+        time = i * adc_period
+        total += sample(time)
+        samples += 1
+        if samples == 1 << VCC_SAMPLES_SHIFT:
+            value = (total << VCC_FRACTION_BITS) >> VCC_SAMPLES_SHIFT
+            total = samples = 0
+            if filtered == 0:
+                average = value << VCC_IIR_SHIFT
+            else:
+                average += value - (average >> VCC_IIR_SHIFT)
+            value = average >> VCC_IIR_SHIFT
+            if abs(value - filtered) > VCC_HYSTERESIS or filtered == 0:
+                filtered = value
+        if filtered:
+            new.append((time, (target * fixed_scale(filtered, gain)) >> DAC_SCALE_SHIFT))
+
+    print(f"Constant 4V target, VCC 5.0V -> 4.95V, gaussian ADC noise {noise} LSB RMS (host simulation)")
+    for name, codes in (("previous", previous), ("new", new)):
+        changes = sum(1 for (time, a), (_, b) in zip(codes, codes[1:]) if a != b and time < duration / 2)
+        still = [code for time, code in codes if time < duration / 2]
+        error = max(abs(code - exact_code(time)) for time, code in codes if time > 0.1)
+        print(
+            f"{name}: {changes / (duration / 2):.2f} code changes per second and "
+            f"{max(still) - min(still)} LSB peak-to-peak at constant VCC, max tracking error {error:.2f} LSB"
+        )
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description="VCC compensation float vs fixed-point model")
+    parser.add_argument("--full", action="store_true", help="check all 256 gain calibration DIP states")
+    parser.add_argument("--stability", action="store_true", help="simulate DAC code stability with noisy VCC")
+    parser.add_argument("--noise", type=float, default=0.7, help="ADC noise in LSB RMS (default: 0.7)")
+    args = parser.parse_args()
+
+    if args.stability:
+        stability(args.noise)
+        return
+
+    dip_states = range(256) if args.full else DIP_STATES
+    compared = identical = 0
+    error_max = 0
+    exact_error_max = {"float": 0.0, "fixed": 0.0}
+    for dip in dip_states:
+        gain = dip_to_gain(dip)
+        for vcc_raw in VCC_RAW_RANGE:
+            codes_float = float_codes(vcc_raw, gain)
+            codes_fixed = fixed_codes(vcc_raw, gain)
+            differences = list(map(abs, map(operator.sub, codes_float, codes_fixed)))
+            error_max = max(error_max, max(differences))
+            identical += differences.count(0)
+            compared += len(TARGETS)
+
+            # Deviation from exact (real numbers) code at the highest unclamped target
+            exact_full = INTERNAL_VREF_MV * 1023.0 / vcc_raw * gain
+            target = min(int(exact_full * MV_Q2_ONE) - 1, TARGETS[-1])
+            exact = target / MV_Q2_ONE / exact_full * DAC_MAX
+            for name, codes in (("float", codes_float), ("fixed", codes_fixed)):
+                exact_error_max[name] = max(exact_error_max[name], abs(codes[target] - exact))
+
+    print(f"{len(dip_states)} gain calibrations x {len(VCC_RAW_RANGE)} VCC readings x {len(TARGETS)} targets")
+    print(f"identical codes: {identical}/{compared} ({identical * 100.0 / compared:.4f}%)")
+    print(f"max difference: {error_max} LSB")
+    for name, error in exact_error_max.items():
+        print(f"{name}: max deviation from exact code near full scale {error:.3f} LSB")
+    if error_max > 1:
+        raise SystemExit("Fixed-point path differs by more than 1 LSB")
+
+
+if __name__ == "__main__":
+    main()
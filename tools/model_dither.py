@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""
+Copyright (c) 2022-2025 Fern Lane
+
+This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+See the License for the specific language governing permissions and
+limitations under the License.
+
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+
+Host-side model of DAC dithering (DAC_DITHER in "include/dac.h"). No dependencies.
+Compares truncation of DAC code (without DAC_DITHER) with first-order sigma-delta dithering in DAC_ENGINE interrupt
+(same as `dither()` in "dac.cpp", 8 fractional bits) for random targets. VCO's CV input filter is modeled as one-pole
+low-pass filter (--cutoff). Reports error of filtered output (static error and ripple) in DAC LSBs and cents
+
+Usage:
+    model_dither.py [--cutoff HZ] [--rates HZ [HZ ...]] [--lsb-mv MV] [--targets N]
+
+Interrupt cost is NOT measured here. `dither()` is ~15 cycles per channel on top of DAC_ENGINE tick (estimated from
+instruction counts). Use `dac_isr_max` / `dac_isr_load` performance counters (`cmcec_sysex.py perf`) to measure it
+on hardware
+"""
+
+import argparse
+import math
+import random
+
+# Same as in "include/dac.h"
+DAC_MAX = 4095
+DAC_DITHER_BITS = 8
+
+# 1V/oct
+CENTS_PER_MV = 1200.0 / 1000.0
+
+
+def simulate(exact: float, rate: float, cutoff: float) -> tuple:
+    """Returns (static error, max error, ripple peak-to-peak) of filtered dithered output in LSBs"""
+    code = int(exact)
+    fraction = int((exact - code) * (1 << DAC_DITHER_BITS))
+    alpha = 1.0 - math.exp(-2.0 * math.pi * cutoff / rate)
+
+    # Settle filter for 10 time constants, then measure over 4 longest limit cycles
+    settle = int(10.0 * rate / (2.0 * math.pi * cutoff)) + 1
+    measure = 4 << DAC_DITHER_BITS
+    error = 0
+    filtered = float(code)
+    total = 0.0
+    low = high = None
+    for i in range(settle + measure):
+        error += fraction
+        output = code + 1 if error >> DAC_DITHER_BITS and code < DAC_MAX else code
+        error &= (1 << DAC_DITHER_BITS) - 1
+        filtered += alpha * (output - filtered)
+        if i >= settle:
+            total += filtered
+            low = filtered if low is None else min(low, filtered)
+            high = filtered if high is None else max(high, filtered)
+    return abs(total / measure - exact), max(abs(low - exact), abs(high - exact)), high - low
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description="DAC dithering model")
+    parser.add_argument("--cutoff", type=float, default=100.0, help="VCO CV input filter cutoff (default: 100Hz)")
+    parser.add_argument("--rates", type=float, nargs="+", default=[2000.0, 4000.0, 8000.0, 16000.0])
+    parser.add_argument("--lsb-mv", type=float, default=2.2, help="DAC LSB in mV (default: 2.2 ~ 9V / 4095)")
+    parser.add_argument("--targets", type=int, default=256, help="number of random targets (default: 256)")
+    args = parser.parse_args()
+
+    rng = random.Random(1)
+    targets = [rng.uniform(100.0, DAC_MAX - 1.0) for _ in range(args.targets)]
+    cents = args.lsb_mv * CENTS_PER_MV
+    print(f"1 LSB = {args.lsb_mv}mV = {cents:.2f} cents, CV filter cutoff {args.cutoff:g}Hz, {len(targets)} targets")
+
+    # Without DAC_DITHER: truncated code
+    truncation = max(target - int(target) for target in targets)
+    print(f"truncation: max error {truncation:.3f} LSB ({truncation * cents:.2f} cents)")
+
+    for rate in args.rates:
+        results = [simulate(target, rate, args.cutoff) for target in targets]
+        static = max(result[0] for result in results)
+        worst = max(result[1] for result in results)
+        ripple = max(result[2] for result in results)
+        gain = math.log2(truncation / worst) if worst > 0 else float("inf")
+        print(
+            f"dither @ {rate:g}Hz: static error {static:.4f} LSB ({static * cents:.3f} cents), "
+            f"ripple {ripple:.3f} LSB p-p, max error {worst:.3f} LSB ({worst * cents:.2f} cents), "
+            f"resolution gain {gain:.1f} bits"
+        )
+
+
+if __name__ == "__main__":
+    main()
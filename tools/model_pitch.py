@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""
+Copyright (c) 2022-2025 Fern Lane
+
+This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+See the License for the specific language governing permissions and
+limitations under the License.
+
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+Host-side accuracy model of note + pitch bend -> DAC conversion.
+Compares previous integer cents path (`(bend - 8192) / 41` + float mV) with Q8.8 pitch / Q14.2 mV fixed-point path
+against exact math. No dependencies
+
+Usage:
+    model_pitch.py
+"""
+
+# Nominal DAC full scale (VCC * GAIN_x_BASE) in mV and DAC maximum (see "include/dac.h")
+FULL_SCALE_MV = 5000.0 * 1.824
+DAC_MAX = 4095
+
+PITCH_SEMITONE = 256
+PITCH_MAX = 127 * PITCH_SEMITONE
+
+
+def c_div(a: int, b: int) -> int:
+    """C integer division (truncates towards zero)"""
+    q = abs(a) // abs(b)
+    return q if (a >= 0) == (b >= 0) else -q
+
+
+def dac_code(mv: float) -> int:
+    """Same as `DAC::calculate_compensation()` (float map and truncation to uint16_t)"""
+    return min(int(mv / FULL_SCALE_MV * DAC_MAX), DAC_MAX)
+
+
+def exact_mv(note: int, bend: int, bend_range: float) -> float:
+    """Exact 1V/Oct voltage of note + bend (clamped to 0-127 notes, as in firmware)"""
+    pitch = min(max(note + bend_range * bend / 8192.0, 0.0), 127.0)
+    return max((pitch - 12.0) * 1000.0 / 12.0, 0.0)
+
+
+def old_mv(note: int, bend: int) -> float:
+    """Previous path: integer cents, fixed +/-2 semitones"""
+    cents = note * 100 + c_div(bend, 41)
+    if cents <= 1200:
+        return 0.0
+    return 1000.0 * (cents // 1200 - 1 + (cents % 1200) / 1200.0)
+
+
+def pitch_to_mv_q2(pitch: int) -> int:
+    """Same as `pitch_to_mv_q2()` in "include/utils.h" """
+    if pitch <= 12 * PITCH_SEMITONE:
+        return 0
+    return (pitch - 12 * PITCH_SEMITONE) * 125 // 96
+
+
+def new_mv(note: int, bend: int, bend_range: float) -> float:
+    """New path: Q8.8 pitch and bend range, Q14.2 mV"""
+    range_q8 = int(bend_range) * PITCH_SEMITONE + int(round((bend_range % 1) * 100)) * PITCH_SEMITONE // 100
+    pitch = note * PITCH_SEMITONE + ((bend * range_q8) >> 13)
+    pitch = min(max(pitch, 0), PITCH_MAX)
+    return pitch_to_mv_q2(pitch) / 4.0
+
+
+def mv_to_cents(mv: float) -> float:
+    return mv * 1.2
+
+
+def compare_bend(bend_range: float, old_supported: bool) -> None:
+    print(f"--- Pitch bend range: +/-{bend_range} semitones ---")
+    paths = {"new": lambda n, b: new_mv(n, b, bend_range)}
+    if old_supported:
+        paths = {"old": old_mv, **paths}
+    for name, path in paths.items():
+        error_max = 0.0
+        steps = set()
+        codes = set()
+        for note in range(24, 116):
+            for bend in range(-8192, 8192):
+                mv = path(note, bend)
+                error_max = max(error_max, abs(mv_to_cents(mv - exact_mv(note, bend, bend_range))))
+                if note == 60:
+                    steps.add(mv)
+                    codes.add(dac_code(mv))
+        print(
+            f"{name}: max error {error_max:.3f} cents, "
+            f"{len(steps)} distinct voltages / {len(codes)} distinct DAC codes over full bend on C4"
+        )
+    exact_codes = {dac_code(exact_mv(60, bend, bend_range)) for bend in range(-8192, 8192)}
+    print(f"exact: {len(exact_codes)} distinct DAC codes over full bend on C4")
+
+
+def compare_matrix() -> None:
+    """Calibration matrix interpolation: float `map_f()` on cents vs fixed-point on Q8.8 pitch"""
+    print("--- Calibrated (matrix) conversion ---")
+
+    # Synthetic slightly non-linear VCO calibration matrix (integer mV per note, as stored in EEPROM)
+    matrix = {note: int(round((note - 12) * 1000.0 / 12.0 * (1.0 + 0.0004 * (note - 60)))) for note in range(12, 120)}
+
+    def interpolate(x: float, note_min: int) -> float:
+        return matrix[note_min] + (matrix[note_min + 1] - matrix[note_min]) * (x - note_min)
+
+    error_old = error_new = 0.0
+    for pitch in range(24 * PITCH_SEMITONE, 118 * PITCH_SEMITONE):
+        x = pitch / PITCH_SEMITONE
+        note_min = pitch // PITCH_SEMITONE
+        exact = interpolate(x, note_min)
+
+        # Old path can only represent whole cents
+        cents = round(x * 100)
+        old = interpolate(cents / 100.0, int(cents / 100))
+
+        # New path (same as `Calibration::note_to_mv_cal()`)
+        distance = pitch - note_min * PITCH_SEMITONE
+        new = (matrix[note_min] * 4 + (((matrix[note_min + 1] - matrix[note_min]) * distance) >> 6)) / 4.0
+
+        error_old = max(error_old, abs(old - exact))
+        error_new = max(error_new, abs(new - exact))
+    print(f"old: max error {error_old:.3f} mV ({mv_to_cents(error_old):.3f} cents)")
+    print(f"new: max error {error_new:.3f} mV ({mv_to_cents(error_new):.3f} cents)")
+
+
+def main() -> None:
+    print(f"DAC resolution: {FULL_SCALE_MV / DAC_MAX:.3f} mV ({mv_to_cents(FULL_SCALE_MV / DAC_MAX):.3f} cents)")
+    compare_bend(2, True)
+    compare_bend(12, False)
+    compare_bend(48, False)
+    compare_matrix()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,442 @@
+/**
+ * @file uart.cpp
+ * @author Fern Lane
+ * @brief Interrupt-driven USART with timestamped receive ring buffer (replaces HardwareSerial for MIDI)
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "include/uart.h"
+#include "include/clock.h"
+#include "include/perf.h"
+#include "include/timebase.h"
+
+#include <util/atomic.h>
+
+// Preinstantiate
+UART uart;
+
+/**
+ * @brief Sets up USART0 as 8N1 receiver (with RX complete interrupt) and transmitter.
+ * NOTE: Does nothing if SERIAL_DEBUG is defined (HardwareSerial owns USART in that case)
+ *
+ * @param baud baud rate (ex. 31250 for MIDI)
+ */
+void UART::init(uint32_t baud) {
+#ifndef SERIAL_DEBUG
+    // Same rounding as HardwareSerial in double speed mode
+    uint16_t ubrr = static_cast<uint16_t>((F_CPU / 4UL / baud - 1UL) / 2UL);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        rx_head = 0U;
+        rx_tail = 0U;
+        tx_head = 0U;
+        tx_tail = 0U;
+#ifdef UART_REALTIME_QUEUE
+        rt_head = 0U;
+        rt_tail = 0U;
+        thru_delay_max = 0U;
+        thru_dropped = 0U;
+#endif
+#ifdef MIDI_THRU
+        thru_head = 0U;
+        thru_tail = 0U;
+        thru_input.status = 0U;
+        thru_input.remaining = 0U;
+        thru_status_queued = false;
+        thru_skip = false;
+        thru_stream.status = 0U;
+        thru_stream.remaining = 0U;
+        local_stream.status = 0U;
+        local_stream.remaining = 0U;
+        tx_source = UartTxSource::NONE;
+        tx_status = 0U;
+#endif
+        UCSR0A = _BV(U2X0);
+        UBRR0H = static_cast<uint8_t>(ubrr >> 8U);
+        UBRR0L = static_cast<uint8_t>(ubrr);
+        UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+        UCSR0B = _BV(RXEN0) | _BV(RXCIE0) | _BV(TXEN0);
+    }
+#endif
+}
+
+/**
+ * @brief Pops oldest received byte from the ring buffer (single consumer, must be called from the main loop only)
+ *
+ * @param data received byte
+ * @param time byte arrival time (see timebase.h)
+ * @return boolean false if buffer is empty
+ */
+boolean UART::read(uint8_t &data, uint32_t &time) {
+    uint8_t tail = rx_tail;
+    if (tail == rx_head)
+        return false;
+
+    data = rx_buffer[tail].data;
+    time = rx_buffer[tail].time;
+    rx_tail = (tail + 1U) & (UART_RX_BUFFER_SIZE - 1U);
+    return true;
+}
+
+/**
+ * @brief Gets arrival time of the oldest received byte without removing it from the receive buffer
+ *
+ * @param time byte's arrival time (see timebase.h)
+ * @return boolean false if buffer is empty
+ */
+boolean UART::peek(uint32_t &time) {
+    uint8_t tail = rx_tail;
+    if (tail == rx_head)
+        return false;
+
+    time = rx_buffer[tail].time;
+    return true;
+}
+
+/**
+ * @brief Pushes byte into the transmit buffer (must be called from the main loop only)
+ *
+ * @param data byte to send
+ * @return boolean false if buffer is full (byte is not sent)
+ */
+boolean UART::write(uint8_t data) {
+#ifndef SERIAL_DEBUG
+    uint8_t head = tx_head;
+    uint8_t head_next = (head + 1U) & (UART_TX_BUFFER_SIZE - 1U);
+    if (head_next == tx_tail)
+        return false;
+
+    tx_buffer[head] = data;
+    tx_head = head_next;
+
+    // Start transmission (data register empty interrupt)
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { UCSR0B |= _BV(UDRIE0); }
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef UART_REALTIME_QUEUE
+/**
+ * @brief Pushes single-byte real-time message (0xF8-0xFF) into the transmit queue. It will be sent ahead of other
+ * messages (even between bytes of them). Safe to call from interrupts
+ *
+ * @param data real-time message to send
+ * @return boolean false if buffer is full (byte is dropped and counted in `thru_dropped`)
+ */
+boolean UART::write_realtime(uint8_t data) {
+#ifndef SERIAL_DEBUG
+    boolean written = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint8_t head = rt_head;
+        uint8_t head_next = (head + 1U) & (UART_REALTIME_BUFFER_SIZE - 1U);
+        if (head_next != rt_tail) {
+            rt_buffer[head].data = data;
+            rt_buffer[head].time = static_cast<uint16_t>(timebase.now());
+            rt_head = head_next;
+            UCSR0B |= _BV(UDRIE0);
+            written = true;
+        } else if (thru_dropped < UINT16_MAX)
+            thru_dropped++;
+    }
+    return written;
+#else
+    return false;
+#endif
+}
+#endif
+
+/**
+ * @brief Calculates free space in transmit buffer
+ *
+ * @return uint8_t number of bytes that can be written without blocking
+ */
+uint8_t UART::tx_free(void) {
+#ifndef SERIAL_DEBUG
+    return (tx_tail - tx_head - 1U) & (UART_TX_BUFFER_SIZE - 1U);
+#else
+    return 0U;
+#endif
+}
+
+/**
+ * @brief Timestamps received byte and pushes it into the ring buffer (single producer).
+ * Real-time bytes are handled right here (without buffering) to minimize clock output jitter.
+ * Newest byte is dropped if buffer is full (see `perf.counters`)
+ */
+void UART::handle_rx(void) {
+    uint32_t time = timebase.now();
+
+    // Data overrun flag must be read before data register
+    if ((UCSR0A & _BV(DOR0)) && perf.counters.rx_overruns < UINT16_MAX)
+        perf.counters.rx_overruns++;
+    uint8_t data = UDR0;
+    perf.counters.rx_bytes++;
+
+#ifdef MIDI_THRU
+    thru(data, static_cast<uint16_t>(time));
+#endif
+
+    // Real-time timing clock and transport fast path (other real-time bytes are not used)
+    if (data >= 0xF8U) {
+        if (data == 0xF8U)
+            clock.midi_tick(time);
+        else
+            clock.midi_transport(data);
+        return;
+    }
+
+    // Song position pointer must be applied before Continue that follows it
+    clock.midi_song_position(data);
+
+    uint8_t head = rx_head;
+    uint8_t head_next = (head + 1U) & (UART_RX_BUFFER_SIZE - 1U);
+    if (head_next == rx_tail) {
+        if (perf.counters.rx_dropped < UINT16_MAX)
+            perf.counters.rx_dropped++;
+        return;
+    }
+
+    rx_buffer[head].data = data;
+    rx_buffer[head].time = time;
+    rx_head = head_next;
+}
+
+#ifdef MIDI_THRU
+/**
+ * @brief Calculates number of data bytes of MIDI message
+ *
+ * @param status status byte (except 0xF0)
+ * @return uint8_t number of data bytes
+ */
+static uint8_t data_length(uint8_t status) {
+    if (status < 0xC0U || (status >= 0xE0U && status < 0xF0U) || status == 0xF2U)
+        return 2U;
+    if (status < 0xE0U || status == 0xF1U || status == 0xF3U)
+        return 1U;
+    return 0U;
+}
+
+/**
+ * @brief Tracks message boundaries of transmitted stream (real-time bytes must not be passed here)
+ *
+ * @param stream stream state
+ * @param data transmitted byte
+ * @return boolean true if byte completes message (so bytes from other source can be sent after it)
+ */
+static boolean stream_track(struct uartStream &stream, uint8_t data) {
+    // Status byte. Only channel messages start running status and SysEx lasts until any other status byte
+    if (data & 0x80U) {
+        stream.status = data < 0xF0U ? data : 0U;
+        stream.remaining = data == 0xF0U ? UINT8_MAX : data_length(data);
+        return stream.remaining == 0U;
+    }
+
+    // SysEx data
+    if (stream.remaining == UINT8_MAX)
+        return false;
+
+    // Next message with running status (or orphan data byte)
+    if (stream.remaining == 0U) {
+        if (!stream.status)
+            return true;
+        stream.remaining = data_length(stream.status);
+    }
+
+    return --stream.remaining == 0U;
+}
+
+/**
+ * @brief Pushes received byte into MIDI THRU buffer and starts transmission right away if transmitter is idle.
+ * NOTE: Must be called with interrupts disabled
+ *
+ * @param data received byte
+ * @param time byte arrival time (lower 16 bits of timebase)
+ */
+void UART::thru(uint8_t data, uint16_t time) {
+    // Real-time bytes bypass other messages
+    if (data >= 0xF8U) {
+        uint8_t head = rt_head;
+        uint8_t head_next = (head + 1U) & (UART_REALTIME_BUFFER_SIZE - 1U);
+        if (head_next != rt_tail) {
+            rt_buffer[head].data = data;
+            rt_buffer[head].time = time;
+            rt_head = head_next;
+        } else if (thru_dropped < UINT16_MAX)
+            thru_dropped++;
+    }
+
+    // Other bytes are queued by whole messages, so dropped message (ex. during long SysEx reply) doesn't break the rest
+    else {
+        uint8_t free = (thru_tail - thru_head - 1U) & (UART_THRU_BUFFER_SIZE - 1U);
+
+        // New message -> check if it fits completely
+        boolean status = data & 0x80U;
+        if (status || (thru_input.remaining == 0U)) {
+            uint8_t length = 1U;
+            if (status && data != 0xF0U)
+                length += data_length(data);
+            else if (!status && thru_input.status)
+                length = data_length(thru_input.status) + (thru_status_queued ? 0U : 1U);
+            thru_skip = length > free;
+
+            // Running status was dropped with previous message -> queue it before data bytes
+            if (!thru_skip && !status && thru_input.status && !thru_status_queued) {
+                thru_push(thru_input.status, time);
+                thru_status_queued = true;
+            }
+            if (status)
+                thru_status_queued = !thru_skip;
+        }
+
+        // SysEx doesn't fit -> drop the rest of it
+        else if (!thru_skip && free == 0U)
+            thru_skip = true;
+
+        if (thru_skip) {
+            if (thru_dropped < UINT16_MAX)
+                thru_dropped++;
+        } else
+            thru_push(data, time);
+        stream_track(thru_input, data);
+    }
+
+    // Send without waiting for data register empty interrupt
+    UCSR0B |= _BV(UDRIE0);
+    if (UCSR0A & _BV(UDRE0))
+        handle_tx();
+}
+
+/**
+ * @brief Pushes byte into MIDI THRU buffer (buffer must have free space)
+ *
+ * @param data byte to forward
+ * @param time byte arrival time (lower 16 bits of timebase)
+ */
+void UART::thru_push(uint8_t data, uint16_t time) {
+    uint8_t head = thru_head;
+    thru_buffer[head].data = data;
+    thru_buffer[head].time = time;
+    thru_head = (head + 1U) & (UART_THRU_BUFFER_SIZE - 1U);
+}
+#endif
+
+#ifdef UART_REALTIME_QUEUE
+/**
+ * @brief Sends queued byte and updates max forwarding delay
+ *
+ * @param entry byte with it's arrival time
+ */
+void UART::send_entry(volatile struct uartTxEntry &entry) {
+    send(entry.data);
+    uint16_t delay = static_cast<uint16_t>(timebase.now()) - entry.time;
+    if (delay > thru_delay_max)
+        thru_delay_max = delay;
+}
+#endif
+
+/**
+ * @brief Writes byte into USART data register and remembers last running status of output
+ *
+ * @param data byte to send
+ */
+void UART::send(uint8_t data) {
+    UDR0 = data;
+#ifdef MIDI_THRU
+    if (data >= 0x80U && data < 0xF8U)
+        tx_status = data < 0xF0U ? data : 0U;
+#endif
+}
+
+/**
+ * @brief Sends next byte or stops transmission if there is nothing to send. Real-time bytes are sent first, then
+ * MIDI THRU and local (transmit buffer) messages are merged. Source is switched only between complete messages and
+ * running status of MIDI THRU stream is restored if local message was sent in the middle of it
+ */
+void UART::handle_tx(void) {
+    uint8_t tail;
+
+#ifdef UART_REALTIME_QUEUE
+    // Real-time bytes can be sent between bytes of any message
+    tail = rt_tail;
+    if (tail != rt_head) {
+        send_entry(rt_buffer[tail]);
+        rt_tail = (tail + 1U) & (UART_REALTIME_BUFFER_SIZE - 1U);
+        return;
+    }
+#endif
+
+#ifdef MIDI_THRU
+    // MIDI THRU has priority between messages
+    if (tx_source != UartTxSource::LOCAL && thru_tail != thru_head)
+        tx_source = UartTxSource::THRU;
+
+    if (tx_source == UartTxSource::THRU) {
+        // Wait for the rest of the message
+        tail = thru_tail;
+        if (tail == thru_head) {
+            UCSR0B &= ~_BV(UDRIE0);
+            return;
+        }
+
+        // Next message uses running status, but other status byte was sent -> restore it first
+        uint8_t data = thru_buffer[tail].data;
+        if (data < 0x80U && thru_stream.remaining == 0U && thru_stream.status && tx_status != thru_stream.status) {
+            send(thru_stream.status);
+            return;
+        }
+
+        send_entry(thru_buffer[tail]);
+        thru_tail = (tail + 1U) & (UART_THRU_BUFFER_SIZE - 1U);
+        if (stream_track(thru_stream, data))
+            tx_source = UartTxSource::NONE;
+        return;
+    }
+#endif
+
+    tail = tx_tail;
+    if (tail == tx_head) {
+        UCSR0B &= ~_BV(UDRIE0);
+        return;
+    }
+
+    uint8_t data = tx_buffer[tail];
+    send(data);
+    tx_tail = (tail + 1U) & (UART_TX_BUFFER_SIZE - 1U);
+#ifdef MIDI_THRU
+    tx_source = stream_track(local_stream, data) ? UartTxSource::NONE : UartTxSource::LOCAL;
+#endif
+}
+
+#ifndef SERIAL_DEBUG
+/**
+ * @brief USART receive complete interrupt (wrapper for `handle_rx()`)
+ */
+ISR(USART_RX_vect) { uart.handle_rx(); }
+
+/**
+ * @brief USART data register empty interrupt (wrapper for `handle_tx()`)
+ */
+ISR(USART_UDRE_vect) { uart.handle_tx(); }
+#endif
@@ -0,0 +1,116 @@
+/**
+ * @file vcc.cpp
+ * @author Fern Lane
+ * @brief Interrupt-driven, oversampled and filtered VCC measurement (against internal 1.1V reference)
+ *
+ * @copyright Copyright (c) 2022-2025 Fern Lane
+ *
+ * This file is part of the ardu-r2r-midi-cv (aka CMCEC) distribution.
+ * See <https://github.com/F33RNI/ardu-r2r-midi-cv> for more info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "include/vcc.h"
+
+#include <util/atomic.h>
+
+#if VCC_SAMPLES_SHIFT > 6U
+#error "VCC_SAMPLES_SHIFT must be less than 7 (sum of samples is 16-bit)"
+#endif
+
+#if VCC_FRACTION_BITS + VCC_IIR_SHIFT > 6U
+#error "VCC_FRACTION_BITS + VCC_IIR_SHIFT must be less than 7 (10-bit average is 16-bit)"
+#endif
+
+// Preinstantiate
+VCC vcc;
+
+/**
+ * @brief Selects internal reference as ADC input (AVcc as reference), waits for it to settle and starts ADC
+ * auto-triggered by Timer0 overflow. Blocks until the first filtered value is ready (~90ms)
+ */
+void VCC::init(void) {
+    // Set the Vref to Vcc and the measurement to the internal 1.1V reference
+#if defined(__AVR_ATmega32U4__) || defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+    ADMUX = _BV(REFS0) | _BV(MUX4) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
+#elif defined(__AVR_ATtiny24__) || defined(__AVR_ATtiny44__) || defined(__AVR_ATtiny84__)
+    ADMUX = _BV(MUX5) | _BV(MUX0);
+#else
+    ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
+#endif
+
+    // Wait for VRef to settle
+    delay(20);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        filtered = 0U;
+        sum = 0U;
+        average = 0U;
+        samples = 0U;
+
+        // Timer0 overflow trigger (Arduino's millis() timer), /128 prescaler (125kHz @ 16MHz), interrupt on completion
+        ADCSRB = _BV(ADTS2);
+        ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADIF) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+    }
+
+    while (get() == 0U)
+        ;
+}
+
+/**
+ * @brief Reads the latest filtered value. Safe to call from main loop
+ *
+ * @return uint16_t measured internal reference in Q10.4 raw ADC units (see VCC_FRACTION_BITS).
+ * VCC in mV is INTERNAL_VREF_MV * 1023 * 2^VCC_FRACTION_BITS / value. 0 if there is no measurement yet
+ */
+uint16_t VCC::get(void) {
+    uint16_t value;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { value = filtered; }
+    return value;
+}
+
+/**
+ * @brief Accumulates conversion result. After every 2^VCC_SAMPLES_SHIFT samples, averages decimated value
+ * (see VCC_IIR_SHIFT) and updates filtered value (with hysteresis)
+ */
+void VCC::handle_conversion(void) {
+    sum += ADC;
+    if (++samples < _BV(VCC_SAMPLES_SHIFT))
+        return;
+
+    uint16_t value = (static_cast<uint32_t>(sum) << VCC_FRACTION_BITS) >> VCC_SAMPLES_SHIFT;
+    sum = 0U;
+    samples = 0U;
+
+    // Average in Q10.(4 + VCC_IIR_SHIFT). First value initializes it
+    if (filtered == 0U)
+        average = value << VCC_IIR_SHIFT;
+    else
+        average += value - (average >> VCC_IIR_SHIFT);
+    value = average >> VCC_IIR_SHIFT;
+
+    // Ignore noise within hysteresis band
+    uint16_t difference = value > filtered ? value - filtered : filtered - value;
+    if (difference > VCC_HYSTERESIS || filtered == 0U)
+        filtered = value;
+}
+
+/**
+ * @brief ADC conversion complete interrupt (wrapper for `handle_conversion()`)
+ */
+ISR(ADC_vect) { vcc.handle_conversion(); }